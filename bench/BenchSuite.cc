@@ -0,0 +1,216 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "VirtualMachine.h"
+
+/*
+ * Benchmark suite: run Lox scripts a few times each, every run in a child
+ * process of its own, and print one JSON object per line and script with
+ * the best wall time, the instructions executed and objects allocated per
+ * second and the peak resident set size. The output is meant to be saved
+ * and compared between commits.
+ */
+
+static constexpr int kDefaultRuns = 3; /*!< Timed runs per script, the best one is reported. */
+
+/*!
+ * \struct Measurement
+ * \brief The Measurement struct holds the outcome of one child run.
+ */
+struct Measurement
+{
+    bool   ok      = false; /*!< Set if the script ran to completion. */
+    double seconds = 0.0;   /*!< Wall time, fork to exit. */
+    long   rss_kb  = 0;     /*!< Peak resident set size of the child. */
+};
+
+/*!
+ * \struct Counts
+ * \brief The Counts struct holds what a profiled child reports back.
+ */
+struct Counts
+{
+    uint64_t instructions    = 0; /*!< Instructions executed. */
+    uint64_t allocations     = 0; /*!< Lox objects allocated. */
+    uint64_t allocated_bytes = 0; /*!< Bytes attributed to those objects. */
+    uint64_t collections     = 0; /*!< Garbage collections run. */
+};
+
+/*!
+ * \brief Run \a source in a child process with its STDOUT discarded.
+ *
+ * \param count_fd If not negative, the run is profiled and the child writes
+ *                 its Counts to this file descriptor.
+ */
+static Measurement
+RunChild(const std::string& source, int count_fd)
+{
+    Measurement measurement;
+    auto start = std::chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0)
+        return measurement;
+
+    if (0 == pid) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd >= 0)
+            dup2(null_fd, STDOUT_FILENO);
+
+        using InterpretResult = lox::vm::VirtualMachine::InterpretResult;
+        lox::vm::VirtualMachine vm;
+        vm.SetProfile(count_fd >= 0);
+        bool ok = (InterpretResult::kInterpretOk == vm.Interpret(source));
+        if (ok && (count_fd >= 0)) {
+            const lox::obj::Heap::Stats& stats = vm.GetHeap().GetStats();
+            Counts counts;
+            counts.instructions    = vm.GetProfiler()->GetInstructionCount();
+            counts.allocations     = stats.allocations;
+            counts.allocated_bytes = stats.allocated_bytes;
+            counts.collections     = stats.collections;
+            ok = (sizeof(counts) == write(count_fd, &counts, sizeof(counts)));
+        }
+        std::fflush(stdout);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    int status = 0;
+    struct rusage usage = {};
+    if (wait4(pid, &status, 0, &usage) < 0)
+        return measurement;
+    auto end = std::chrono::steady_clock::now();
+
+    measurement.ok      = WIFEXITED(status) && (0 == WEXITSTATUS(status));
+    measurement.seconds = std::chrono::duration<double>(end - start).count();
+    measurement.rss_kb  = usage.ru_maxrss;
+    return measurement;
+}
+
+/*!
+ * \brief Return the instructions executed and the objects allocated by
+ *        \a source, all zero if they could not be obtained.
+ *
+ * The counts come from a separate profiled run: profiling slows the VM down
+ * too much for the timed runs.
+ */
+static Counts
+Count(const std::string& source)
+{
+    int fds[2];
+    if (pipe(fds) < 0)
+        return {};
+
+    Measurement measurement = RunChild(source, fds[1]);
+    close(fds[1]);
+    Counts counts;
+    if (!measurement.ok ||
+        (sizeof(counts) != read(fds[0], &counts, sizeof(counts))))
+        counts = {};
+    close(fds[0]);
+    return counts;
+}
+
+/*!
+ * \brief Return the benchmark name of \a path, its file name without the
+ *        .lox extension.
+ */
+static std::string
+BenchmarkName(const std::string& path)
+{
+    std::size_t slash = path.find_last_of('/');
+    std::string name =
+        (std::string::npos == slash) ? path : path.substr(slash + 1);
+    std::size_t dot = name.rfind(".lox");
+    if ((std::string::npos != dot) && (dot + 4 == name.size()))
+        name.erase(dot);
+
+    /* The name ends up in a JSON string. */
+    name.erase(std::remove_if(name.begin(), name.end(),
+                              [](char c) {
+                                  return ('"' == c) || ('\\' == c) ||
+                                         (static_cast<unsigned char>(c) < 0x20);
+                              }),
+               name.end());
+    return name;
+}
+
+/*!
+ * \brief Benchmark the script at \a path and print its JSON line.
+ *
+ * \return \c false if the script could not be read or failed to run.
+ */
+static bool
+Benchmark(const std::string& path, int runs)
+{
+    std::string name = BenchmarkName(path);
+    std::ifstream script_fd(path);
+    if (!script_fd.is_open()) {
+        std::printf("{\"benchmark\": \"%s\", \"error\": \"unable to open "
+                    "script\"}\n", name.c_str());
+        return false;
+    }
+    std::stringstream buffer;
+    buffer << script_fd.rdbuf();
+    const std::string source = buffer.str();
+
+    double best = 0.0;
+    long rss_kb = 0;
+    for (int run = 0; run < runs; ++run) {
+        Measurement measurement = RunChild(source, -1);
+        if (!measurement.ok) {
+            std::printf("{\"benchmark\": \"%s\", \"error\": \"script "
+                        "failed\"}\n", name.c_str());
+            return false;
+        }
+        best   = (0 == run) ? measurement.seconds
+                            : std::min(best, measurement.seconds);
+        rss_kb = std::max(rss_kb, measurement.rss_kb);
+    }
+
+    Counts counts = Count(source);
+    std::printf("{\"benchmark\": \"%s\", \"runs\": %d, "
+                "\"wall_seconds\": %.6f, \"instructions\": %llu, "
+                "\"instructions_per_second\": %.0f, \"allocations\": %llu, "
+                "\"allocations_per_second\": %.0f, \"allocated_bytes\": %llu, "
+                "\"collections\": %llu, \"peak_rss_kb\": %ld}\n",
+                name.c_str(), runs, best,
+                static_cast<unsigned long long>(counts.instructions),
+                (best > 0.0) ? (counts.instructions / best) : 0.0,
+                static_cast<unsigned long long>(counts.allocations),
+                (best > 0.0) ? (counts.allocations / best) : 0.0,
+                static_cast<unsigned long long>(counts.allocated_bytes),
+                static_cast<unsigned long long>(counts.collections), rss_kb);
+    std::fflush(stdout);
+    return true;
+}
+
+int main(int argc, char** argv)
+{
+    int runs = kDefaultRuns;
+    int arg  = 1;
+    if ((arg + 1 < argc) && (std::string(argv[arg]) == "--runs")) {
+        runs = std::atoi(argv[arg + 1]);
+        arg += 2;
+    }
+    if ((arg == argc) || (runs < 1)) {
+        std::fprintf(stderr,
+                     "usage: bench_suite [--runs count] script_path...\n");
+        return EXIT_FAILURE;
+    }
+
+    bool ok = true;
+    for (; arg < argc; ++arg)
+        ok = Benchmark(argv[arg], runs) && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,80 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+
+#include "Scanner.h"
+
+/*
+ * Scanner benchmark: tokenize a large input built by repeating a Lox
+ * script and report tokens/sec and MB/sec. Only the Scanner runs, so the
+ * figures are not diluted by compilation or execution.
+ */
+
+static constexpr std::size_t kDefaultInputBytes =
+    64 << 20; /*!< Default size of the scanned input. */
+static constexpr int kRuns = 5; /*!< Number of timed scans, the best one is reported. */
+
+/*!
+ * \brief Scan \a source to the end and return the number of tokens.
+ */
+static std::size_t
+ScanAll(const std::string& source)
+{
+    using TokenType = lox::scanr::Token::TokenType;
+
+    lox::scanr::Scanner scanner(source);
+    std::size_t tokens = 0;
+    while (scanner.ScanToken().GetType() != TokenType::kEof)
+        tokens++;
+    return tokens;
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc < 2) || (argc > 3)) {
+        std::fprintf(stderr, "usage: scan_throughput script_path [repeat]\n");
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream script_fd(argv[1]);
+    if (!script_fd.is_open()) {
+        std::fprintf(stderr, "error: unable to open script '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    std::stringstream buffer;
+    buffer << script_fd.rdbuf();
+    const std::string script = buffer.str() + "\n";
+
+    std::size_t repeat = std::max<std::size_t>(
+        kDefaultInputBytes / script.size(), 1);
+    if (argc > 2)
+        repeat = std::max(std::atoi(argv[2]), 1);
+
+    std::string source;
+    source.reserve(script.size() * repeat);
+    for (std::size_t i = 0; i < repeat; ++i)
+        source += script;
+
+    std::size_t tokens  = 0;
+    double      seconds = 0.0;
+    for (int run = 0; run < kRuns; ++run) {
+        auto start = std::chrono::steady_clock::now();
+        tokens = ScanAll(source);
+        auto end = std::chrono::steady_clock::now();
+
+        double elapsed = std::chrono::duration<double>(end - start).count();
+        if ((0 == run) || (elapsed < seconds))
+            seconds = elapsed;
+    }
+
+    double megabytes = static_cast<double>(source.size()) / (1 << 20);
+    std::printf("%12s %12s %10s %14s %10s\n",
+                "bytes", "tokens", "seconds", "tokens/sec", "MB/sec");
+    std::printf("%12zu %12zu %10.3f %14.0f %10.1f\n", source.size(), tokens,
+                seconds, tokens / seconds, megabytes / seconds);
+    return EXIT_SUCCESS;
+}
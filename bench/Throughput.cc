@@ -0,0 +1,102 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+#include <atomic>
+#include <fstream>
+#include <sstream>
+
+#include "VirtualMachine.h"
+
+/*
+ * Throughput benchmark: run independent copies of a Lox script on a
+ * growing number of threads. Each job gets a fresh VirtualMachine, the
+ * way a job runner would evaluate unrelated scripts, so the only thing the
+ * threads share is the (read only) source text.
+ */
+
+/*!
+ * \brief Run \a jobs copies of \a source on each of \a threads threads.
+ *
+ * \return The wall time in seconds or a negative value if a job failed.
+ */
+static double
+RunJobs(const std::string& source, unsigned threads, unsigned jobs)
+{
+    std::atomic<bool> failed(false);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < threads; ++i) {
+        workers.emplace_back([&source, &failed, jobs]() {
+            using InterpretResult = lox::vm::VirtualMachine::InterpretResult;
+            for (unsigned j = 0; j < jobs; ++j) {
+                lox::vm::VirtualMachine vm;
+                if (InterpretResult::kInterpretOk != vm.Interpret(source))
+                    failed = true;
+            }
+        });
+    }
+    for (std::thread& worker : workers)
+        worker.join();
+    auto end = std::chrono::steady_clock::now();
+
+    if (failed)
+        return -1.0;
+    return std::chrono::duration<double>(end - start).count();
+}
+
+int main(int argc, char** argv)
+{
+    if ((argc < 2) || (argc > 4)) {
+        std::fprintf(stderr,
+                     "usage: throughput script_path [max_threads] "
+                     "[jobs_per_thread]\n");
+        return EXIT_FAILURE;
+    }
+
+    std::ifstream script_fd(argv[1]);
+    if (!script_fd.is_open()) {
+        std::fprintf(stderr, "error: unable to open script '%s'\n", argv[1]);
+        return EXIT_FAILURE;
+    }
+    std::stringstream buffer;
+    buffer << script_fd.rdbuf();
+    const std::string source = buffer.str();
+
+    unsigned max_threads = std::thread::hardware_concurrency();
+    if (argc > 2)
+        max_threads = static_cast<unsigned>(std::atoi(argv[2]));
+    if (0 == max_threads)
+        max_threads = 1;
+    unsigned jobs = (argc > 3) ? static_cast<unsigned>(std::atoi(argv[3]))
+                               : 100;
+
+    /* Double the thread count up to the limit, always ending with the
+       limit itself. */
+    std::vector<unsigned> thread_counts;
+    for (unsigned threads = 1; threads < max_threads; threads *= 2)
+        thread_counts.push_back(threads);
+    thread_counts.push_back(max_threads);
+
+    double base_rate = 0.0;
+    std::printf("%8s %8s %10s %12s %8s\n",
+                "threads", "jobs", "seconds", "jobs/sec", "speedup");
+    for (unsigned threads : thread_counts) {
+        double seconds = RunJobs(source, threads, jobs);
+        if (seconds < 0.0) {
+            std::fprintf(stderr, "error: script failed\n");
+            return EXIT_FAILURE;
+        }
+
+        double rate = (threads * jobs) / seconds;
+        if (1 == threads)
+            base_rate = rate;
+        std::printf("%8u %8u %10.3f %12.1f %8.2f\n", threads, threads * jobs,
+                    seconds, rate, rate / base_rate);
+        std::fflush(stdout);
+    }
+    return EXIT_SUCCESS;
+}
@@ -8,6 +8,14 @@
 
 namespace lox
 {
+/* Forward declaration of lox::obj types referenced by inline caches to avoid
+   a circular dependency between lox::Chunk and lox::obj. */
+namespace obj
+{
+    class Shape;
+    struct ObjClass;
+    struct ObjClosure;
+} // end obj
 
 /*!
  * \class Chunk
@@ -19,6 +27,31 @@ public:
     /*!
      * \enum OpCode
      * \brief The OpCode enum defines the instruction types supported by Lox.
+     *
+     * The opcodes suffixed with Long are wide variants of the instruction of
+     * the same name. Their constant, slot or global operand is 24 bits wide
+     * instead of 8 bits (16 bits for globals). The Compiler only emits them
+     * once an index no longer fits the short form.
+     *
+     * kOpGetMethod reads a property like kOpGetProperty, with the same
+     * operands. The Compiler emits it when the property is called right
+     * away, as in (obj.method)(args): a method it binds is recycled by the
+     * call (see VirtualMachine::CallValue()).
+     *
+     * kOpJumpIfTrue and the superinstructions that follow it are never
+     * emitted by the Compiler directly, Optimize() produces them by fusing
+     * common instruction sequences:
+     *
+     *     kOpJumpIfTrue          : kOpNot, kOpJumpIfFalse
+     *     kOpGetLocalGetLocal    : kOpGetLocal a, kOpGetLocal b
+     *     kOpGetLocalConstantAdd : kOpGetLocal a, kOpConstant k, kOpAdd
+     *     kOpGetLocalGetProperty : kOpGetLocal a, kOpGetProperty name ic
+     *     kOpLessJumpIfFalse     : kOpLess, kOpJumpIfFalse, kOpPop (on both
+     *                              paths, the condition is not left on the
+     *                              stack)
+     *
+     * A superinstruction's operands are those of the fused instructions, in
+     * order.
      */
     enum OpCode
     {
@@ -28,8 +61,11 @@ public:
         kOpTrue,
         kOpFalse,
         KOpEqual,
+        kOpNotEqual,
         kOpGreater,
+        kOpGreaterEqual,
         kOpLess,
+        kOpLessEqual,
         kOpNot,
         kOpNegate,
         kOpAdd,
@@ -58,9 +94,71 @@ public:
         kOpInvoke,
         kOpInherit,
         kOpGetSuper,
-        kOpSuperInvoke
+        kOpSuperInvoke,
+        kOpConstantLong,
+        kOpDefineGlobalLong,
+        kOpGetGlobalLong,
+        kOpSetGlobalLong,
+        kOpGetLocalLong,
+        kOpSetLocalLong,
+        kOpClosureLong,
+        kOpClassLong,
+        kOpSetPropertyLong,
+        kOpGetPropertyLong,
+        kOpMethodLong,
+        kOpInvokeLong,
+        kOpGetSuperLong,
+        kOpSuperInvokeLong,
+        kOpGetMethod,
+        kOpGetMethodLong,
+        kOpJumpIfTrue,
+        kOpGetLocalGetLocal,
+        kOpGetLocalConstantAdd,
+        kOpGetLocalGetProperty,
+        kOpLessJumpIfFalse
     }; // end OpCode
 
+    static constexpr uint32_t kMaxLongOperand =
+        0xFFFFFF; /*!< Largest operand encodable by a Long instruction. */
+
+    /*!
+     * \struct InlineCache
+     * \brief The InlineCache struct memoizes the lookup of one property
+     *        instruction.
+     *
+     * Every kOpGetProperty, kOpGetMethod, kOpSetProperty and kOpInvoke
+     * instruction owns one InlineCache, referenced by a 16-bit operand. A
+     * cache hits when the receiver has the remembered #shape (and, for
+     * kOpInvoke, #klass).
+     */
+    struct InlineCache
+    {
+        const obj::Shape* shape      = nullptr; /*!< Receiver shape the entry is valid for. */
+        uint32_t          slot       = 0;       /*!< Field index within the receiver. */
+        obj::Shape*       transition = nullptr; /*!< kOpSetProperty: shape after adding the field, or nullptr if it exists. */
+        obj::ObjClass*    klass      = nullptr; /*!< kOpInvoke: receiver class. */
+        obj::ObjClosure*  method     = nullptr; /*!< kOpInvoke: method found in #klass. */
+    }; // end InlineCache
+
+    static constexpr std::size_t kMaxInlineCaches =
+        UINT16_MAX + 1; /*!< Number of caches addressable by a 16-bit operand. */
+
+    /*!
+     * \struct LineRun
+     * \brief The LineRun struct attributes a range of bytecode to one
+     *        source line.
+     *
+     * The line table is run-length encoded: a run covers the bytes from
+     * #start up to the start of the next run (or the end of the code).
+     * Consecutive bytes mostly come from the same line so a Chunk holds
+     * far fewer runs than bytes.
+     */
+    struct LineRun
+    {
+        int start; /*!< Offset of the first byte of the run. */
+        int line;  /*!< Source line of the bytes in the run. */
+    }; // end LineRun
+
     /* The defaults for compiler generated methods are appropriate. */
     Chunk() = default;
     ~Chunk() = default;
@@ -94,10 +192,37 @@ public:
     GetConstants() const { return constants_; }
 
     /*!
-     * \brief Return a read only view of the Chunk's line array.
+     * \brief Return a read only view of the Chunk's line table.
      */
-    const std::vector<int>&
-    GetLines() const { return lines_; }
+    const std::vector<LineRun>&
+    GetLineRuns() const { return lines_; }
+
+    /*!
+     * \brief Return the source line of the byte at offset \a offset.
+     *
+     * The lookup is a binary search over the line runs, it is meant for
+     * error reporting and disassembly rather than for the hot path.
+     */
+    int
+    GetLine(int offset) const;
+
+    /*!
+     * \brief Return the Chunk's inline caches.
+     */
+    std::vector<InlineCache>&
+    GetInlineCaches() { return caches_; }
+
+    /*!
+     * \brief Return a read only view of the Chunk's inline caches.
+     */
+    const std::vector<InlineCache>&
+    GetInlineCaches() const { return caches_; }
+
+    /*!
+     * \brief Add an empty InlineCache to the Chunk and return its index.
+     */
+    std::size_t
+    AddInlineCache();
 
     /*!
      * \brief Write a raw byte to the Chunk.
@@ -109,6 +234,12 @@ public:
     void
     Write(uint8_t byte, int line);
 
+    /*!
+     * \brief Write \a count raw bytes, all attributed to source line \a line.
+     */
+    void
+    Write(const uint8_t* bytes, std::size_t count, int line);
+
     /*!
      * \brief Add a new Lox constant value to the Chunk.
      *
@@ -119,6 +250,90 @@ public:
     int
     AddConstant(const val::Value& value);
 
+    /*!
+     * \brief Remove the constant added last.
+     */
+    void
+    PopConstant() { constants_.pop_back(); }
+
+    /*!
+     * \brief Discard the code past the first \a size bytes.
+     */
+    void
+    Truncate(std::size_t size);
+
+    /*!
+     * \brief Return the name of opcode \a op as printed by the disassembler
+     *        (e.g., "OP_ADD").
+     */
+    static const char*
+    GetOpCodeName(uint8_t op);
+
+    /*!
+     * \brief Return the size in bytes, operands included, of the
+     *        instruction at offset \a offset.
+     */
+    std::size_t
+    InstructionSize(int offset) const;
+
+    /*!
+     * \brief Return the largest number of stack slots the Chunk's code
+     *        occupies at any point of its execution.
+     *
+     * The result bounds the stack space a call of the function owning this
+     * Chunk needs. The VM reserves it up front so instructions can push
+     * without checking for overflow.
+     *
+     * \param base Number of slots in use on entry (i.e., the callee and its
+     *             arguments).
+     */
+    int
+    MaxStackSlots(int base) const;
+
+    /*!
+     * \brief Return \c true if the Chunk's code is well formed.
+     *
+     * Every opcode must be known and every instruction must fit in the code.
+     * Every operand must index into its table: constants, of the right type
+     * where a name or a function is expected, globals, upvalues and inline
+     * caches. Jumps must land on an instruction. The stack must have the
+     * same depth on every path reaching an instruction, which never pops
+     * below the callee's slot or reads a local slot past the top, and no
+     * path may run past the end of the code. Verify() does not check the
+     * type of the values an instruction consumes, the VM checks those it
+     * relies on.
+     *
+     * \param arity         Number of arguments of the function owning the
+     *                      Chunk.
+     * \param upvalue_count Number of upvalues of that function.
+     * \param globals       Number of global variable slots.
+     * \param caches        Number of inline caches of the Chunk, which may
+     *                      not be allocated yet.
+     */
+    bool
+    Verify(int arity,
+           int upvalue_count,
+           std::size_t globals,
+           std::size_t caches) const;
+
+    /*!
+     * \brief Rewrite the Chunk's code with a peephole pass.
+     *
+     * The pass threads jumps that land on other jumps, removes values that
+     * are pushed only to be popped, fuses kOpNot with a following
+     * kOpJumpIfFalse, folds the negation of numeric constants and drops
+     * jumps to the next instruction. It then fuses common sequences into
+     * superinstructions (see OpCode). Jump offsets and the line table are
+     * rebuilt to match the new code.
+     *
+     * Optimize() relies on the same structured control flow as
+     * MaxStackSlots() and must run before the latter.
+     *
+     * \return The number of bytes removed from the code.
+     */
+    std::size_t
+    Optimize();
+
     /*!
      * \brief Disassemble all instructions in this Chunk.
      *
@@ -150,10 +365,42 @@ private:
     std::size_t
     DisassembleSimpleInstruction(const std::string& name, int offset) const;
     std::size_t
-    DisassembleConstantInstruction(const std::string& name, int offset) const;
+    DisassembleConstantInstruction(const std::string& name,
+                                   int offset,
+                                   int width = 1) const;
     std::size_t
     DisassembleByteInstruction(const std::string& name, int offset) const;
 
+    /*!
+     * \brief Print a superinstruction starting with a local slot operand
+     *        (e.g., kOpGetLocalGetLocal) to STDOUT.
+     */
+    std::size_t
+    DisassembleLocalSuperInstruction(const std::string& name,
+                                     int offset) const;
+
+    /*!
+     * \brief Print an instruction with a 16-bit operand (e.g., a global
+     *        variable slot) to STDOUT.
+     */
+    std::size_t
+    DisassembleShortInstruction(const std::string& name, int offset) const;
+
+    /*!
+     * \brief Print an instruction with a 24-bit operand (i.e., the local
+     *        and global slot operands of the Long instructions) to STDOUT.
+     */
+    std::size_t
+    DisassembleLongInstruction(const std::string& name, int offset) const;
+
+    /*!
+     * \brief Print a closure instruction and its upvalue descriptors.
+     */
+    std::size_t
+    DisassembleClosureInstruction(const std::string& name,
+                                  int offset,
+                                  int width) const;
+
     /*!
      * \brief Print a jump instruction to STDOUT.
      *
@@ -166,10 +413,34 @@ private:
                                int sign,
                                int offset) const;
     std::size_t
-    DisassembleInvokeInstruction(const std::string& name, int offset) const;
+    DisassembleInvokeInstruction(const std::string& name,
+                                 int offset,
+                                 int width = 1) const;
+
+    /*!
+     * \brief Print a property instruction and its inline cache index.
+     *
+     * \param name      Instruction label.
+     * \param offset    Offset of instruction in the Chunk's bytecode vector.
+     * \param has_args  \c true if the name operand is followed by an
+     *                  argument count (i.e., kOpInvoke).
+     * \param width     Size of the name operand in bytes.
+     */
+    std::size_t
+    DisassemblePropertyInstruction(const std::string& name,
+                                   int offset,
+                                   bool has_args,
+                                   int width = 1) const;
+
+    /*!
+     * \brief Return the \a width byte big-endian operand at \a offset.
+     */
+    uint32_t
+    ReadOperand(int offset, int width) const;
 
     std::vector<uint8_t>    code_;      /*!< Vector of compiled bytecode instructions. */
     std::vector<val::Value> constants_; /*!< Vector of constants parsed from the source text. */
-    std::vector<int>        lines_;     /*!< Vector of line numbers. */
+    std::vector<LineRun>    lines_;     /*!< Run-length encoded line numbers (see LineRun). */
+    std::vector<InlineCache> caches_;   /*!< Inline caches of the property instructions. */
 }; // end Chunk
 } // end lox
@@ -3,11 +3,13 @@
 #include <cstdint>
 #include <memory>
 #include <string>
-#include <functional>
-#include <unordered_map>
+#include <string_view>
+#include <vector>
 
 #include "Value.h"
 #include "Object.h"
+#include "Heap.h"
+#include "Globals.h"
 #include "Chunk.h"
 #include "Scanner.h"
 
@@ -22,9 +24,6 @@ namespace cl
 class Compiler
 {
 public:
-    using InternedStrings = std::shared_ptr<std::unordered_map<std::string,
-                                            std::shared_ptr<obj::ObjString>>>;
-
     Compiler();
 
     ~Compiler() = default;
@@ -36,17 +35,30 @@ public:
     /*!
      * \brief Compile \a source code to bytecode.
      *
-     * \param source Lox source text.
-     * \param strings Pointer to a map containing all interned strings.
+     * The functions under construction are registered as GC roots with
+     * \a heap for the duration of the call.
+     *
+     * \param source  Lox source text. Tokens refer to it directly so it
+     *                must stay alive for the duration of the call.
+     * \param heap    Heap which owns all objects (and interned strings)
+     *                created during compilation.
+     * \param globals Global variable slots. Every global name referenced by
+     *                \a source is resolved to a slot of \a globals.
+     * \param optimize Fold expressions whose operands are literals and run
+     *                 the peephole pass (see Chunk::Optimize()) over each
+     *                 compiled function.
      * \return A pointer to the compiled Lox function object.
      */
-    std::shared_ptr<obj::ObjFunction>
-    Compile(const std::string& source, InternedStrings strings);
+    obj::ObjFunction*
+    Compile(std::string_view source,
+            obj::Heap& heap,
+            obj::Globals& globals,
+            bool optimize = true);
 
 private:
     using Token     = lox::scanr::Token;
     using TokenType = lox::scanr::Token::TokenType;
-    using ParseFn   = std::function<void(Compiler*, bool)>;
+    using ParseFn   = void (Compiler::*)(bool);
 
     /*!
      * \enum Precedence
@@ -110,7 +122,7 @@ private:
      */
     struct Upvalue
     {
-        uint8_t index;    /*!< Tracks the closed-over local variables's slot index. */
+        uint32_t index;   /*!< Tracks the closed-over local variables's slot index. */
         bool    is_local; /*!< Tracks whether this upvalue was resolved locally. */
     }; // end Upvalue
 
@@ -133,14 +145,18 @@ private:
     struct CompilerData
     {
         std::shared_ptr<CompilerData>     enclosing; /*!< Metadata of the next compiler on the compiler stack. */
-        std::shared_ptr<obj::ObjFunction> function;  /*!< Function being compiled. */
+        obj::ObjFunction*             function;  /*!< Function being compiled. */
         FunctionType type;                    /*!< FunctionType of #function. */
-        Local        locals[UINT8_MAX +1];    /*!< Array of local variable data. */
-        int          local_count;             /*!< Length of locals array. */
+        std::vector<Local> locals;            /*!< Local variable data, the first #local_count entries are in scope. */
+        int          local_count;             /*!< Number of locals in scope. */
         int          scope_depth;             /*!< Active scope depth (global=0). */
         Upvalue      upvalues[UINT8_MAX + 1]; /*!< Array of closure upvalues. */
+        obj::Table   strings;                 /*!< Map of string constants to their index in #function's Chunk. */
     }; // end CompilerData
 
+    static constexpr int kMaxLocals =
+        Chunk::kMaxLongOperand + 1; /*!< Number of locals addressable by kOpGetLocalLong. */
+
     using CompilerDataPtr = std::shared_ptr<CompilerData>;
     /*!
      * \struct ClassCompiler
@@ -152,8 +168,16 @@ private:
         bool           has_superclass; /*!< Superclass flag. */
     }; // end ClassCompiler
 
-    static std::unordered_map<TokenType, ParseRule>
-    rules_; /*!< Lookup table mapping TokenType to a ParseRule. */
+    /* The table is built at compile time and shared by every Compiler:
+       Compilers may run concurrently on different threads. */
+    static const ParseRule
+    rules_[]; /*!< Parse rules indexed by TokenType. */
+
+    /*!
+     * \brief Return the ParseRule of \a type.
+     */
+    static const ParseRule&
+    GetRule(TokenType type);
 
     /*!
      * \brief Initialize \a compiler.
@@ -172,6 +196,12 @@ private:
                  CompilerDataPtr compiler,
                  FunctionType type);
 
+    /*!
+     * \brief Mark the functions of every CompilerData on the compiler stack.
+     */
+    void
+    MarkCompilerRoots(obj::Heap& heap);
+
     /*!
      * \brief Return a reference to the Chunk of the function being compiled.
      */
@@ -186,15 +216,17 @@ private:
 
     /*!
      * \brief Parse a variable.
+     *
+     * \return The global slot of the variable or 0 if it is a local.
      */
-    uint8_t
-    ParseVariable(const std::string& error_message);
+    uint32_t
+    ParseVariable(std::string_view error_message);
 
     /*!
      * \brief Emit bytecode for a variable definition.
      */
     void
-    DefineVariable(uint8_t global);
+    DefineVariable(uint32_t global);
 
     /*!
      * \brief Compile a Lox statement.
@@ -320,7 +352,7 @@ private:
      * \brief Add an upvalue to the parameter compiler's upvalue array.
      */
     int
-    AddUpvalue(CompilerDataPtr compiler, uint8_t index, bool is_local);
+    AddUpvalue(CompilerDataPtr compiler, uint32_t index, bool is_local);
 
     /*!
      * \brief Declare a variable (local or global).
@@ -389,9 +421,15 @@ private:
     /*!
      * \brief Compile the identifier represented by \a name.
      */
-    uint8_t
+    uint32_t
     IdentifierConstant(const Token& name);
 
+    /*!
+     * \brief Return the global variable slot assigned to \a name.
+     */
+    uint32_t
+    GlobalSlot(const Token& name);
+
     /*!
      * \brief Consume the current Token if its type matches \a type.
      *
@@ -400,13 +438,17 @@ private:
      * with message \a message.
      */
     void
-    Consume(TokenType type, const std::string& message);
+    Consume(TokenType type, std::string_view message);
 
     /*!
      * \brief Compile \a value into a bytecode constant.
+     *
+     * String constants are deduplicated: a string already in the current
+     * Chunk's constant array reuses its index.
+     *
      * \return The index of \a value in the current Chunk's constant array.
      */
-    uint8_t
+    uint32_t
     MakeConstant(const val::Value& value);
 
     /*!
@@ -419,20 +461,20 @@ private:
      * \brief Print error info to STDERR.
      */
     void
-    ErrorAt(const Token& error, const std::string& message);
+    ErrorAt(const Token& error, std::string_view message);
 
     /*!
      * \brief Print error info for the current token.
      */
     void
-    ErrorAtCurrent(const std::string& message)
+    ErrorAtCurrent(std::string_view message)
         { ErrorAt(parser_.current, message); }
 
     /*!
      * \brief Print error info for the previous token.
      */
     void
-    Error(const std::string& message) { ErrorAt(parser_.previous, message); }
+    Error(std::string_view message) { ErrorAt(parser_.previous, message); }
 
     /*!
      * \brief Write \a byte to the current Chunk.
@@ -447,6 +489,43 @@ private:
     void
     EmitBytes(uint8_t byte1, uint8_t byte2);
 
+    /*!
+     * \brief Write \a instruction followed by its 16-bit \a operand.
+     */
+    void
+    EmitShortOperand(uint8_t instruction, uint16_t operand);
+
+    /*!
+     * \brief Write the 24-bit \a operand to the current Chunk.
+     */
+    void
+    EmitLongOperand(uint32_t operand);
+
+    /*!
+     * \brief Write an instruction taking a constant or local slot \a index.
+     *
+     * \a instruction with a byte operand is written if \a index fits in a
+     * byte, else \a long_instruction with a 24-bit operand is written.
+     */
+    void
+    EmitIndexed(uint8_t instruction, uint8_t long_instruction, uint32_t index);
+
+    /*!
+     * \brief Write a global variable instruction for global \a slot.
+     *
+     * \a instruction with a 16-bit operand is written if \a slot fits in 16
+     * bits, else \a long_instruction with a 24-bit operand is written.
+     */
+    void
+    EmitGlobal(uint8_t instruction, uint8_t long_instruction, uint32_t slot);
+
+    /*!
+     * \brief Allocate an InlineCache in the current Chunk and write its
+     *        16-bit index as the operand of the previous instruction.
+     */
+    void
+    EmitInlineCache();
+
     /*!
      * \brief Write a return instruction to the current Chunk.
      */
@@ -470,12 +549,59 @@ private:
      */
     void
     EmitConstant(const val::Value& value)
-        { EmitBytes(Chunk::OpCode::kOpConstant, MakeConstant(value)); }
+    {
+        EmitIndexed(Chunk::OpCode::kOpConstant, Chunk::OpCode::kOpConstantLong,
+                    MakeConstant(value));
+    }
+
+    /*!
+     * \brief Return \c true if the code emitted from offset \a start to
+     *        the end of the current Chunk is a single instruction loading a
+     *        literal (i.e., nil, a boolean, a number or a string), in which
+     *        case the literal is stored in \a value.
+     */
+    bool
+    LiteralAt(int start, val::Value* value);
+
+    /*!
+     * \brief Replace the literal loads emitted from offset \a start to the
+     *        end of the current Chunk with a single load of \a value.
+     *
+     * \a constants is the size of the constant array when the code at
+     * \a start was emitted. The constants added since are only loaded by
+     * the discarded code: they are removed, strings along with their
+     * CompilerData::strings entry (see MakeConstant()), before \a value is
+     * added.
+     */
+    void
+    ReplaceLiterals(int start, std::size_t constants, const val::Value& value);
+
+    /*!
+     * \brief Return \c true if the last instruction of the code emitted
+     *        from offset \a start to the end of the current Chunk is a
+     *        kOpGetProperty (or kOpGetPropertyLong), whose offset is stored
+     *        in \a get.
+     */
+    bool
+    PropertyGetAt(int start, int* get);
+
+    /*!
+     * \brief Evaluate the binary operator \a type on the literals \a a and
+     *        \a b at compile time.
+     *
+     * \return \c false, leaving \a result untouched, if the operation must
+     *         be left to the VM (e.g., it raises a runtime error).
+     */
+    bool
+    FoldBinary(TokenType type,
+               const val::Value& a,
+               const val::Value& b,
+               val::Value* result);
 
     /*!
      * \brief End compilation.
      */
-    std::shared_ptr<obj::ObjFunction>
+    obj::ObjFunction*
     EndCompiler();
 
     /* Parser action functions. */
@@ -523,9 +649,13 @@ private:
 
     lox::scanr::Scanner scanner_;       /*!< Token scanner. */
     Parser              parser_;        /*!< Handle to the Parser. */
-    InternedStrings     interned_strs_; /*!< Collection of interned strings. */
+    obj::Heap*          heap_;          /*!< Heap owning compiled objects. */
+    obj::Globals*       globals_;       /*!< Global variable slots. */
     CompilerDataPtr     current_;       /*!< Compiler metadata. */
     ClassCompiler*      current_class_; /*!< Current class under compilation. */
+    bool                optimize_;      /*!< Fold constant expressions and run Chunk::Optimize() on compiled functions. */
+    int                 operand_start_; /*!< Offset of the left operand of the infix rule being parsed. */
+    std::size_t         operand_constants_; /*!< Size of the constant array when that operand began. */
 }; // end Compiler
 } // end cl
 } // end lox
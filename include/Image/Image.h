@@ -0,0 +1,106 @@
+#pragma once
+
+#include <string>
+#include <cstdint>
+
+#include "Object.h"
+#include "Heap.h"
+#include "Globals.h"
+
+namespace lox
+{
+/*!
+ * \namespace img
+ * \brief Saving and loading of compiled bytecode images (.loxc files).
+ *
+ * An image holds the output of the Compiler for one script: the script
+ * function, every function nested in it and the global variable slots their
+ * instructions refer to. Loading an image skips scanning and compiling
+ * altogether.
+ *
+ * All integers are stored little endian, the layout is:
+ *
+ *     header    : "\x89LOX", u16 version, u16 reserved
+ *     strings   : u32 count, count x { u32 length, length bytes }
+ *     globals   : u32 count, count x u32 string index (in slot order)
+ *     functions : u32 count, count x function (the script comes first)
+ *
+ *     function  : u32 name (string index or kNoName), i32 arity,
+ *                 i32 upvalue count, i32 max slots, u32 inline caches,
+ *                 u32 code length, code bytes,
+ *                 u32 line runs, runs x { i32 line, u32 length },
+ *                 u32 constants, constants x { u8 ConstantTag, payload }
+ *
+ * Strings are stored once and referenced by index, so every name and
+ * string constant is interned exactly once on load. Functions reference
+ * each other (i.e., closure constants) by index as well.
+ *
+ * The loader maps the file in memory and decodes it in place: the only
+ * copies made are into the Heap objects the VM executes. Besides the
+ * structure of the file, the loader checks the bytecode of every function
+ * (see Chunk::Verify()) so that no operand reaches outside of its table.
+ *
+ * The magic starts with a byte that cannot begin a Lox script, so a
+ * script is never mistaken for an image.
+ */
+namespace img
+{
+static constexpr char kImageMagic[] = "\x89LOX"; /*!< First bytes of every image. */
+
+static constexpr uint16_t kImageVersion =
+    4; /*!< Image format version, bump it whenever the layout or the opcode set changes. */
+
+static constexpr uint32_t kNoName =
+    UINT32_MAX; /*!< Name index of the (anonymous) script function. */
+
+/*!
+ * \enum ConstantTag
+ * \brief The ConstantTag enum defines the type byte preceding each constant.
+ */
+enum ConstantTag : uint8_t
+{
+    kTagNil,      /*!< nil, no payload. */
+    kTagFalse,    /*!< false, no payload. */
+    kTagTrue,     /*!< true, no payload. */
+    kTagNumber,   /*!< Number, IEEE 754 double as a u64. */
+    kTagString,   /*!< String, u32 string index. */
+    kTagFunction  /*!< Function, u32 function index. */
+}; // end ConstantTag
+
+/*!
+ * \brief Return \c true if the file at \a path starts with the image magic.
+ */
+bool
+IsImage(const std::string& path);
+
+/*!
+ * \brief Write the compiled \a script to the image file \a path.
+ *
+ * \param script  Top level function returned by the Compiler.
+ * \param globals Globals the script was compiled against.
+ * \param path    Destination file, overwritten if it exists.
+ *
+ * \return \c false, after printing an error to STDERR, if the image could
+ *         not be written.
+ */
+bool
+WriteImage(const obj::ObjFunction* script,
+           const obj::Globals& globals,
+           const std::string& path);
+
+/*!
+ * \brief Load the image file \a path.
+ *
+ * The global variable names of the image are resolved in \a globals. They
+ * must map to the slots they had when the image was written, which is the
+ * case for a VM in its initial state (i.e., with only the natives
+ * defined).
+ *
+ * \return The script function or \c nullptr, after printing an error to
+ *         STDERR, if the image is unreadable, malformed or of another
+ *         version.
+ */
+obj::ObjFunction*
+LoadImage(const std::string& path, obj::Heap& heap, obj::Globals& globals);
+} // end img
+} // end lox
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Value.h"
+#include "Table.h"
+
+namespace lox
+{
+namespace obj
+{
+struct ObjString;
+
+/*!
+ * \class Globals
+ * \brief The Globals class stores global variables in numbered slots.
+ *
+ * The Compiler resolves every global variable name to a slot index once,
+ * at compile time, and emits that index as the operand of the global
+ * variable instructions (16 bits wide, or 24 bits for the Long forms). The
+ * VM then reads and writes globals by indexing a dense array. A slot
+ * holding val::UndefinedVal() belongs to a name that has been referenced
+ * but not yet defined.
+ *
+ * Name lookups only happen in the Compiler and when reporting errors. Since
+ * a name always maps to the same slot, a REPL line redefining a global
+ * simply overwrites the slot assigned by an earlier line.
+ */
+class Globals
+{
+public:
+    static constexpr std::size_t kMaxGlobals =
+        1 << 24; /*!< Number of slots addressable by a 24-bit operand. */
+
+    /*!
+     * \brief Return the slot of \a name, allocating an undefined slot for a
+     *        name seen for the first time.
+     *
+     * \param name Interned variable name.
+     */
+    std::size_t
+    Resolve(ObjString* name);
+
+    /*!
+     * \brief Return the number of allocated slots.
+     */
+    std::size_t
+    Size() const { return values_.size(); }
+
+    /*!
+     * \brief Return the value stored in \a slot.
+     */
+    const val::Value&
+    Get(std::size_t slot) const { return values_[slot]; }
+
+    /*!
+     * \brief Store \a value in \a slot.
+     */
+    void
+    Set(std::size_t slot, const val::Value& value) { values_[slot] = value; }
+
+    /*!
+     * \brief Return the name of the variable stored in \a slot.
+     */
+    ObjString*
+    Name(std::size_t slot) const { return names_[slot]; }
+
+    /*!
+     * \brief Return the slot names, indexed by slot.
+     */
+    const std::vector<ObjString*>&
+    Names() const { return names_; }
+
+    /*!
+     * \brief Return the slot values, indexed by slot.
+     */
+    const std::vector<val::Value>&
+    Values() const { return values_; }
+
+private:
+    Table                   slots_;  /*!< Map of names to their slot index (stored as a number). */
+    std::vector<ObjString*> names_;  /*!< Slot names, used for error reporting. */
+    std::vector<val::Value> values_; /*!< Slot values. */
+}; // end Globals
+} // end obj
+} // end lox
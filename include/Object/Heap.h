@@ -0,0 +1,266 @@
+#pragma once
+
+#include <new>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+#include <functional>
+
+#include "Value.h"
+#include "Object.h"
+#include "Table.h"
+#include "Shape.h"
+#include "ObjectPool.h"
+
+namespace lox
+{
+namespace obj
+{
+/*!
+ * \class Heap
+ * \brief The Heap class owns every Lox object and reclaims them by tracing.
+ *
+ * Heap implements a stop-the-world mark-and-sweep garbage collector. All
+ * objects are threaded onto an intrusive list (see Obj::next). A collection
+ * is triggered whenever an allocation would push the number of live bytes
+ * past a threshold. After each collection, the threshold is reset to the
+ * number of surviving bytes scaled by a configurable growth factor.
+ *
+ * The Heap knows nothing about where roots live. Clients (the VM, the
+ * Compiler) register root marker callbacks which are invoked at the start
+ * of every collection to mark the objects they directly reference.
+ *
+ * Object memory comes from an ObjectPool: the objects freed by a sweep are
+ * recycled by later allocations and the memory goes back to the system
+ * only when the Heap is destroyed.
+ */
+class Heap
+{
+public:
+    using RootMarker  = std::function<void(Heap&)>;
+    using InternTable = Table;
+
+    static constexpr std::size_t kDefaultGcThreshold  =
+        1024 * 1024; /*!< Live bytes that trigger the first collection. */
+    static constexpr std::size_t kDefaultGcGrowFactor =
+        2;           /*!< Threshold multiplier applied after a collection. */
+
+    /*!
+     * \struct Stats
+     * \brief The Stats struct counts the Heap's activity since its creation.
+     */
+    struct Stats
+    {
+        uint64_t allocations     = 0; /*!< Objects allocated. */
+        uint64_t allocated_bytes = 0; /*!< Bytes attributed to the allocated objects. */
+        uint64_t frees           = 0; /*!< Objects freed. */
+        uint64_t collections     = 0; /*!< Garbage collections run. */
+    }; // end Stats
+
+    /*!
+     * \brief Construct an empty Heap.
+     *
+     * \param gc_threshold   Number of allocated bytes that triggers the first
+     *                       collection.
+     * \param gc_grow_factor After each collection, the next threshold is set
+     *                       to the surviving byte count times this factor.
+     */
+    explicit Heap(std::size_t gc_threshold   = kDefaultGcThreshold,
+                  std::size_t gc_grow_factor = kDefaultGcGrowFactor);
+
+    /*!
+     * \brief Free every object still owned by the Heap.
+     */
+    ~Heap();
+
+    Heap(const Heap&) = delete;
+    Heap& operator=(const Heap&) = delete;
+    Heap(Heap&&) = delete;
+    Heap& operator=(Heap&&) = delete;
+
+    /*!
+     * \brief Allocate a new object of type \a T and register it with the GC.
+     *
+     * Allocate() may trigger a collection \e before the new object is
+     * linked in. Callers must therefore make sure any object they are still
+     * holding on to is reachable from a root prior to calling Allocate().
+     *
+     * \param type         ObjType tag of the new object.
+     * \param extra_bytes  Heap memory owned by the object beyond sizeof(T).
+     * \param inline_bytes Storage placed right after the object, in the
+     *                     same block (see ObjString::Chars()).
+     */
+    template <typename T>
+    T*
+    Allocate(ObjType type, std::size_t extra_bytes = 0,
+             std::size_t inline_bytes = 0);
+
+    /*!
+     * \brief Register a callback which marks roots at the start of a GC.
+     *
+     * Root markers form a stack so that nested clients (e.g., a Compiler
+     * running within a VM) can add and remove their roots in LIFO order.
+     */
+    void
+    PushRootMarker(RootMarker marker) { root_markers_.push_back(marker); }
+
+    /*!
+     * \brief Unregister the root marker most recently pushed.
+     */
+    void
+    PopRootMarker() { root_markers_.pop_back(); }
+
+    /*!
+     * \brief Return the table of interned strings.
+     *
+     * The intern table holds weak references: strings that are not
+     * reachable from any root are removed from the table during a GC. Keys
+     * are the interned strings themselves, values are unused (nil).
+     */
+    InternTable&
+    Strings() { return strings_; }
+
+    /*!
+     * \brief Return the Shape of instances without fields.
+     *
+     * Every Shape reachable from the empty Shape lives as long as the
+     * Heap, and their field names are treated as roots.
+     */
+    Shape*
+    EmptyShape() { return &empty_shape_; }
+
+    /*!
+     * \brief Run a full mark-and-sweep collection.
+     */
+    void
+    CollectGarbage();
+
+    /*!
+     * \brief Mark \a object as reachable and queue it for tracing.
+     */
+    void
+    MarkObject(Obj* object);
+
+    /*!
+     * \brief Mark the object referenced by \a value, if any.
+     */
+    void
+    MarkValue(const val::Value& value);
+
+    /*!
+     * \brief Mark every key and value of \a table.
+     */
+    void
+    MarkTable(const Table& table);
+
+    /*!
+     * \brief Return the number of bytes currently attributed to live objects.
+     */
+    std::size_t
+    BytesAllocated() const { return bytes_allocated_; }
+
+    /*!
+     * \brief Return the allocation threshold that triggers the next GC.
+     */
+    std::size_t
+    NextGc() const { return next_gc_; }
+
+    /*!
+     * \brief Return the allocation and collection counters.
+     */
+    const Stats&
+    GetStats() const { return stats_; }
+
+    /*!
+     * \brief Return the number of bytes the object pool reserved from the
+     *        system.
+     */
+    std::size_t
+    PoolBytes() const { return pool_.ReservedBytes(); }
+
+private:
+    /*!
+     * \brief Link a freshly constructed \a object into the object list.
+     *
+     * Track() runs a collection first if accounting \a size more bytes would
+     * exceed the current threshold.
+     */
+    void
+    Track(Obj* object, std::size_t size);
+
+    /*!
+     * \brief Mark every object referenced by the gray \a object.
+     */
+    void
+    BlackenObject(Obj* object);
+
+    /*!
+     * \brief Drain the gray stack.
+     */
+    void
+    TraceReferences();
+
+    /*!
+     * \brief Drop unmarked strings from the intern table.
+     */
+    void
+    RemoveWhiteStrings();
+
+    /*!
+     * \brief Free every unmarked object and clear the mark on the survivors.
+     */
+    void
+    Sweep();
+
+    /*!
+     * \brief Release \a object's memory.
+     */
+    void
+    FreeObject(Obj* object);
+
+    /*!
+     * \brief Destroy \a object and return its memory, \a inline_bytes
+     *        included, to the pool.
+     *
+     * \return The size of the block, accounted for the object itself.
+     */
+    template <typename T>
+    std::size_t
+    Destroy(T* object, std::size_t inline_bytes = 0);
+
+    Obj*                    objects_;         /*!< Head of the list of all allocated objects. */
+    std::size_t             bytes_allocated_; /*!< Bytes attributed to allocated objects. */
+    std::size_t             next_gc_;         /*!< Threshold that triggers the next GC. */
+    std::size_t             gc_grow_factor_;  /*!< Threshold multiplier applied after each GC. */
+    std::vector<Obj*>       gray_stack_;      /*!< Marked objects whose references are not yet traced. */
+    std::vector<RootMarker> root_markers_;    /*!< Callbacks marking client roots. */
+    InternTable             strings_;         /*!< Weak table of interned strings. */
+    Shape                   empty_shape_;     /*!< Root of the tree of instance shapes. */
+    Stats                   stats_;           /*!< Allocation and collection counters. */
+    ObjectPool              pool_;            /*!< Memory of the objects, outlives every object. */
+}; // end Heap
+
+template <typename T>
+T*
+Heap::Allocate(
+    ObjType type,
+    std::size_t extra_bytes,
+    std::size_t inline_bytes)
+{
+    T* object    = new (pool_.Allocate(sizeof(T) + inline_bytes)) T();
+    object->type = type;
+    Track(object, sizeof(T) + inline_bytes + extra_bytes);
+
+    return object;
+}
+
+template <typename T>
+std::size_t
+Heap::Destroy(T* object, std::size_t inline_bytes)
+{
+    object->~T();
+    pool_.Free(object, sizeof(T) + inline_bytes);
+    return sizeof(T) + inline_bytes;
+}
+} // end obj
+} // end lox
@@ -1,18 +1,22 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
-#include <memory>
 #include <functional>
-#include <unordered_map>
 
 #include "Value.h"
 #include "Chunk.h"
+#include "Table.h"
+#include "Shape.h"
 
 namespace lox
 {
 namespace obj
 {
+class Heap;
+
 /*!
  * \enum ObjType
  * \brief The ObjType enum names all the Lox object types.
@@ -35,21 +39,59 @@ enum ObjType
  */
 struct Obj
 {
-    ObjType type;
+    ObjType type;      /*!< Concrete type of this object. */
+    bool    is_marked; /*!< Flag set by the GC when the object is reachable. */
+    Obj*    next;      /*!< Next object in the Heap's list of all objects. */
 }; // end Obj
 
+static constexpr std::size_t kMinRopeLength =
+    64; /*!< Length from which concatenation builds a rope (see ObjString). */
+
 /*!
  * \struct ObjString
  * \brief The ObjString struct represents Lox strings.
  *
- * ObjString is a thin wrapper around C++'s std::string type.
+ * The characters of a flat ObjString follow the struct in the same
+ * allocation, null terminated, see Chars(). Flat strings are interned, so
+ * two flat strings are equal if and only if they are the same object. The
+ * hash of the characters is computed once on creation so that hash table
+ * lookups keyed by the string never have to rehash it.
+ *
+ * Concatenating strings of kMinRopeLength or more characters in total
+ * creates a rope instead: a string whose characters are those of #left
+ * followed by those of #right. Building a rope copies no characters, so a
+ * loop appending to a string runs in linear rather than quadratic time.
+ * Ropes are not interned, FlattenString() turns a rope into its interned
+ * flat string the first time it is compared. The rope then forwards to
+ * that string through #flat and releases its operands. A rope has no
+ * characters of its own.
  */
 struct ObjString :
     public Obj
 {
-    std::string chars;
+    uint32_t    hash   = 0;       /*!< HashString() of Chars(). */
+    std::size_t length = 0;       /*!< Number of characters, ropes included. */
+    ObjString*  left   = nullptr; /*!< Rope: first operand, nullptr once flattened. */
+    ObjString*  right  = nullptr; /*!< Rope: second operand, nullptr once flattened. */
+    ObjString*  flat   = nullptr; /*!< Rope: interned flat string, once flattened. */
+
+    /*!
+     * \brief Return the #length characters of a flat string, followed by
+     *        a null character.
+     */
+    char*
+    Chars() { return reinterpret_cast<char*>(this + 1); }
+
+    const char*
+    Chars() const { return reinterpret_cast<const char*>(this + 1); }
 }; // end ObjString
 
+/*!
+ * \brief Return \c true if \a string is a rope, flattened or not.
+ */
+inline bool
+IsRope(const ObjString* string) { return (string->left || string->flat); }
+
 /*!
  * \struct ObjFunction
  * \brief The ObjFunction struct represents a User defined function.
@@ -59,8 +101,9 @@ struct ObjFunction :
 {
     int        arity;         /*!< Number of arguments expected by the function. */
     int        upvalue_count; /*!< Number of upvalues referenced. */
+    int        max_slots;     /*!< Stack slots needed by a call (see Chunk::MaxStackSlots()). */
     lox::Chunk chunk;         /*!< Chunk of bytecode representing the function body. */
-    std::shared_ptr<ObjString> name; /*!< Name of the function. */
+    ObjString* name;          /*!< Name of the function. */
 }; // end ObjFunction
 
 /*!
@@ -72,7 +115,7 @@ struct ObjUpvalue :
 {
     val::Value* location; /*!< Pointer to location of upvalue on the stack. */
     val::Value  closed;   /*!< Copy of a closed upvalue. */
-    std::shared_ptr<ObjUpvalue> next; /*!< Pointer to the next closed upvalue. */
+    ObjUpvalue* next;     /*!< Pointer to the next open upvalue. */
 }; // end ObjUpvalue
 
 /*!
@@ -82,12 +125,11 @@ struct ObjUpvalue :
 struct ObjClosure :
     public Obj
 {
-    std::shared_ptr<ObjFunction>             function; /*!< Closed function. */
-    std::vector<std::shared_ptr<ObjUpvalue>> upvalues; /*!< Vector of upvalues referenced by this closure (see ObjUpvalue). */
-    int                                      upvalue_count; /*!< Number of upvalues referenced by this closure. */
+    ObjFunction*             function;      /*!< Closed function. */
+    std::vector<ObjUpvalue*> upvalues;      /*!< Vector of upvalues referenced by this closure (see ObjUpvalue). */
+    int                      upvalue_count; /*!< Number of upvalues referenced by this closure. */
 }; // end ObjClosure
 
-using Table = std::unordered_map<std::shared_ptr<ObjString>, val::Value>;
 /*!
  * \struct ObjClass
  * \brief The ObjClass struct represents a class object.
@@ -95,19 +137,23 @@ using Table = std::unordered_map<std::shared_ptr<ObjString>, val::Value>;
 struct ObjClass :
     public Obj
 {
-    std::shared_ptr<ObjString> name;    /*!< Class name mainly for error reporting. */
-    Table                      methods; /*!< Map of class methods. */
+    ObjString* name;    /*!< Class name mainly for error reporting. */
+    Table      methods; /*!< Map of class methods. */
 }; // end ObjClass
 
 /*!
  * \struct ObjInstance
  * \brief The ObjInstance struct represent class instances.
+ *
+ * Field values are stored in a flat array in the order they were first
+ * assigned. The instance's Shape maps field names to array indices.
  */
 struct ObjInstance :
     public Obj
 {
-    std::shared_ptr<ObjClass> klass;  /*!< Name of the class. */
-    Table                     fields; /*!< Instance state data. */
+    ObjClass*               klass;  /*!< Name of the class. */
+    Shape*                  shape;  /*!< Layout of #fields. */
+    std::vector<val::Value> fields; /*!< Instance state data, indexed through #shape. */
 }; // end ObjInstance
 
 /*!
@@ -117,8 +163,9 @@ struct ObjInstance :
 struct ObjBoundMethod :
     public Obj
 {
-    val::Value                  receiver; /*!< Representation of 'this'. */
-    std::shared_ptr<ObjClosure> method;   /*!< Method bound to receiver. */
+    val::Value  receiver;          /*!< Representation of 'this'. */
+    ObjClosure* method;            /*!< Method bound to receiver. */
+    bool        transient = false; /*!< Bound by kOpGetMethod and not called yet. */
 }; // end ObjBoundMethod
 
 using NativeFn = std::function<val::Value(int,val::Value*)>;
@@ -141,59 +188,77 @@ GetType(const val::Value& value);
 /*!
  * \brief Convert \a value to a Value with obj type info and data.
  */
-val::Value
-ObjVal(std::shared_ptr<Obj> value);
+inline val::Value
+ObjVal(Obj* value)
+{
+#ifdef NAN_BOXING
+    return {val::kSignBit | val::kQuietNan |
+            static_cast<uint64_t>(reinterpret_cast<uintptr_t>(value))};
+#else
+    return val::Value{val::ValueType::kObj, value};
+#endif
+}
 
 /*!
  * \brief Convert \a value to a Lox object pointer.
  */
-std::shared_ptr<Obj>
-AsObj(const val::Value& value);
+inline Obj*
+AsObj(const val::Value& value)
+{
+#ifdef NAN_BOXING
+    return reinterpret_cast<Obj*>(static_cast<uintptr_t>(
+        value.bits & ~(val::kSignBit | val::kQuietNan)));
+#else
+    return std::get<Obj*>(value.as);
+#endif
+}
 
 /*!
  * \brief Convert \a value to a Lox ObjString.
  */
-std::shared_ptr<ObjString>
+ObjString*
 AsString(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a Lox ObjFunction.
  */
-std::shared_ptr<ObjFunction>
+ObjFunction*
 AsFunction(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a NativeFn function object.
  */
-NativeFn
+const NativeFn&
 AsNative(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a ObjClosure object.
  */
-std::shared_ptr<ObjClosure>
+ObjClosure*
 AsClosure(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a ObjClass object.
  */
-std::shared_ptr<ObjClass>
+ObjClass*
 AsClass(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a ObjInstance object.
  */
-std::shared_ptr<ObjInstance>
+ObjInstance*
 AsInstance(const val::Value& value);
 
 /*!
  * \brief Convert \a value to a ObjBoundMethod object.
  */
-std::shared_ptr<ObjBoundMethod>
+ObjBoundMethod*
 AsBoundMethod(const val::Value& value);
 
 /*!
  * \brief Convert \a value to Lox ObjString and return the underlying std::string.
+ *
+ * The characters of a rope are gathered without flattening it.
  */
 std::string
 AsStdString(const val::Value& value);
@@ -201,8 +266,17 @@ AsStdString(const val::Value& value);
 /*!
  * \brief Return \c true if \a value represents a Lox object.
  */
-bool
-IsObject(const val::Value& value);
+#ifdef NAN_BOXING
+constexpr bool
+IsObject(const val::Value& value)
+{
+    return ((value.bits & (val::kSignBit | val::kQuietNan)) ==
+            (val::kSignBit | val::kQuietNan));
+}
+#else
+inline bool
+IsObject(const val::Value& value) { return (value.type == val::ValueType::kObj); }
+#endif
 
 /*!
  * \brief Return \c true if \a value is an Object with type \a type.
@@ -252,72 +326,94 @@ IsInstance(const val::Value& value);
 bool
 IsBoundMethod(const val::Value& value);
 
+/*!
+ * \brief Return the 32-bit FNV-1a hash of the \a length bytes at \a key.
+ */
+uint32_t
+HashString(const char* key, std::size_t length);
+
 /*!
  * \brief Construct an ObjString initialized with \a str data.
  *
- * CopyString() will create a ObjString pointer and register it with \a strs
- * if \a str does not already exist in \a strs. Otherwise, a copy of \a str
- * is not performed an instead the existing pointer in \a strs is returned.
+ * CopyString() will create a ObjString pointer and register it with the
+ * intern table of \a heap if \a str does not already exist in the table.
+ * Otherwise, a copy of \a str is not performed an instead the existing
+ * pointer in the table is returned.
  *
+ * \param heap Heap owning the new object and the intern string table.
  * \param str A string object identified by the Compiler.
- * \param strs Pointer to a map of std::string objects to
- *             std::shared_ptr<ObjString>. The \a strs map is used to identify
- *             whether \a str is already being tracked by the interpreter.
  */
-std::shared_ptr<ObjString>
-CopyString(
-    const std::string& str,
-    std::shared_ptr<std::unordered_map<std::string, std::shared_ptr<ObjString>>>
-        strs);
+ObjString*
+CopyString(Heap& heap, std::string_view str);
+
+/*!
+ * \brief Construct a rope holding the concatenation of \a left and \a right.
+ *
+ * \a left and \a right must be reachable from a root: the allocation may
+ * trigger a GC.
+ */
+ObjString*
+NewRope(Heap& heap, ObjString* left, ObjString* right);
+
+/*!
+ * \brief Return the interned flat string equal to \a string.
+ *
+ * A flat \a string is returned as is. A rope is flattened on the first
+ * call (see ObjString), \a string must then be reachable from a root since
+ * interning its characters may trigger a GC.
+ */
+ObjString*
+FlattenString(Heap& heap, ObjString* string);
 
 /*!
  * \brief Return a pointer to a 'blank slate' Lox function object.
  */
-std::shared_ptr<ObjFunction>
-NewFunction();
+ObjFunction*
+NewFunction(Heap& heap);
 
 /*!
  * \brief Return a pointer to a new native function.
  */
-std::shared_ptr<ObjNative>
-NewNative(NativeFn function);
+ObjNative*
+NewNative(Heap& heap, NativeFn function);
 
 /*!
  * \brief Return a pointer to a new ObjClosure object.
  */
-std::shared_ptr<ObjClosure>
-NewClosure(std::shared_ptr<ObjFunction> function);
+ObjClosure*
+NewClosure(Heap& heap, ObjFunction* function);
 
 /*!
  * \brief Return a pointer to a new ObjUpvalue object.
  */
-std::shared_ptr<ObjUpvalue>
-NewUpvalue(val::Value* slot);
+ObjUpvalue*
+NewUpvalue(Heap& heap, val::Value* slot);
 
 /*!
  * \brief Return a pointer to a new ObjClass object.
  */
-std::shared_ptr<ObjClass>
-NewClass(std::shared_ptr<ObjString> name);
+ObjClass*
+NewClass(Heap& heap, ObjString* name);
 
 /*!
  * \brief Return a pointer to a new ObjInstance object.
  */
-std::shared_ptr<ObjInstance>
-NewInstance(std::shared_ptr<ObjClass> klass);
+ObjInstance*
+NewInstance(Heap& heap, ObjClass* klass);
 
 /*!
  * \brief Return a pointer to a new ObjBoundMethod object.
  */
-std::shared_ptr<ObjBoundMethod>
+ObjBoundMethod*
 NewBoundMethod(
+    Heap& heap,
     const val::Value& receiver,
-    std::shared_ptr<ObjClosure> method);
+    ObjClosure* method);
 
 /*!
  * \brief Print the name of \a function to STDOUT.
  */
 void
-PrintFunction(std::shared_ptr<ObjFunction> function);
+PrintFunction(const ObjFunction* function);
 } // end obj
 } // end lox
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace lox
+{
+namespace obj
+{
+/*!
+ * \class ObjectPool
+ * \brief The ObjectPool class hands out the memory of small Lox objects.
+ *
+ * Blocks are grouped in size classes kGranularity bytes apart and carved
+ * out of kSlabSize byte slabs with a bump pointer. A freed block goes on
+ * the free list of its size class and is reused by the next allocation of
+ * that class, so a steady state of allocations and collections never calls
+ * into the system allocator. Slabs are only released, all at once, when
+ * the pool is destroyed.
+ *
+ * The pool manages raw memory: constructing and destroying the objects is
+ * left to the Heap. Building with -DOBJECT_POOL=OFF turns the pool into a
+ * pass-through to operator new and delete, e.g. so that AddressSanitizer
+ * can track every object.
+ */
+class ObjectPool
+{
+public:
+    static constexpr std::size_t kGranularity =
+        16; /*!< Size class spacing, also the alignment of every block. */
+    static constexpr std::size_t kMaxBlockSize =
+        256; /*!< Largest pooled size, larger objects use operator new. */
+    static constexpr std::size_t kSlabSize =
+        64 * 1024; /*!< Bytes reserved from the system at a time. */
+
+    ObjectPool() = default;
+    ~ObjectPool() = default;
+    ObjectPool(const ObjectPool&) = delete;
+    ObjectPool& operator=(const ObjectPool&) = delete;
+    ObjectPool(ObjectPool&&) = delete;
+    ObjectPool& operator=(ObjectPool&&) = delete;
+
+    /*!
+     * \brief Return an uninitialized block of at least \a size bytes.
+     */
+    void*
+    Allocate(std::size_t size);
+
+    /*!
+     * \brief Return the block \a block, obtained from Allocate(size), to
+     *        the pool.
+     */
+    void
+    Free(void* block, std::size_t size);
+
+    /*!
+     * \brief Return the number of bytes reserved in slabs.
+     */
+    std::size_t
+    ReservedBytes() const { return slabs_.size() * kSlabSize; }
+
+private:
+    static constexpr std::size_t kSizeClasses =
+        kMaxBlockSize / kGranularity; /*!< Number of free lists. */
+
+    /*!
+     * \struct FreeBlock
+     * \brief The FreeBlock struct links the free blocks of a size class.
+     */
+    struct FreeBlock
+    {
+        FreeBlock* next; /*!< Next free block of the same size class. */
+    }; // end FreeBlock
+
+    std::array<FreeBlock*, kSizeClasses>      free_lists_ = {}; /*!< Free blocks by size class. */
+    std::vector<std::unique_ptr<std::byte[]>> slabs_;           /*!< Every slab, released by the destructor. */
+    std::byte*                                bump_       = nullptr; /*!< Next unused byte of the current slab. */
+    std::byte*                                bump_end_   = nullptr; /*!< End of the current slab. */
+}; // end ObjectPool
+} // end obj
+} // end lox
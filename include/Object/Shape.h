@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "Table.h"
+
+namespace lox
+{
+namespace obj
+{
+class Heap;
+struct ObjString;
+
+/*!
+ * \class Shape
+ * \brief The Shape class describes the field layout of an ObjInstance.
+ *
+ * A Shape (a.k.a. hidden class) maps field names to indices into the flat
+ * ObjInstance::fields array. Instances that received the same fields in
+ * the same order share a Shape, so a (Shape, index) pair remembered by an
+ * inline cache is valid for every instance with that Shape.
+ *
+ * Shapes form a tree rooted at the empty Shape owned by the Heap. Adding a
+ * field to an instance moves it to a child Shape via Transition(). Shapes
+ * are never freed before their Heap: their number is bounded by the
+ * distinct field orders of the program, and immortality guarantees that a
+ * Shape pointer held by a cache can never be reused for another layout.
+ */
+class Shape
+{
+public:
+    Shape() = default;
+    ~Shape() = default;
+    Shape(const Shape&) = delete;
+    Shape& operator=(const Shape&) = delete;
+    Shape(Shape&&) = delete;
+    Shape& operator=(Shape&&) = delete;
+
+    /*!
+     * \brief Return the field index of \a name or -1 if there is none.
+     */
+    int
+    Lookup(const ObjString* name) const;
+
+    /*!
+     * \brief Return the Shape obtained by appending field \a name.
+     *
+     * The child Shape is created on first use and reused afterwards. The
+     * new field's index is the size of this Shape.
+     */
+    Shape*
+    Transition(ObjString* name);
+
+    /*!
+     * \brief Return the number of fields described by this Shape.
+     */
+    std::size_t
+    Size() const { return size_; }
+
+    /*!
+     * \brief Mark the field names of this Shape and all its descendants.
+     */
+    void
+    Mark(Heap& heap) const;
+
+private:
+    using ShapePtr = std::unique_ptr<Shape>;
+
+    Table       slots_;              /*!< Map of field names to their index (stored as a number). */
+    std::size_t size_ = 0;           /*!< Number of fields. */
+    std::vector<std::pair<ObjString*, ShapePtr>>
+                transitions_;        /*!< Children keyed by the name of the field they add. */
+}; // end Shape
+} // end obj
+} // end lox
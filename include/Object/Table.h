@@ -0,0 +1,138 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Value.h"
+
+namespace lox
+{
+namespace obj
+{
+struct ObjString;
+
+/*!
+ * \class Table
+ * \brief The Table class is a hash table mapping interned strings to Values.
+ *
+ * Table uses open addressing with linear probing over a power-of-two sized
+ * array of entries. Keys are compared by pointer which is only correct
+ * because every ObjString used as a key is interned. The hash of a key is
+ * cached in the ObjString so it is never recomputed on lookup.
+ *
+ * Deleted entries are replaced by tombstones (a null key with a \c true
+ * value) so that probe sequences running through them are not cut short.
+ * Tombstones count towards the load factor and are purged on resize.
+ */
+class Table
+{
+public:
+    /*!
+     * \struct Entry
+     * \brief The Entry struct is a single key/value slot of a Table.
+     *
+     * An empty slot has a null key and a nil value. A tombstone has a null
+     * key and a non-nil value.
+     */
+    struct Entry
+    {
+        ObjString* key;   /*!< Interned key or \c nullptr if unused. */
+        val::Value value; /*!< Value associated with #key. */
+    }; // end Entry
+
+    static constexpr std::size_t kMinCapacity = 8; /*!< Capacity of the first allocation. */
+
+    /* The defaults for compiler generated methods are appropriate. */
+    Table() = default;
+    ~Table() = default;
+    Table(const Table&) = default;
+    Table& operator=(const Table&) = default;
+    Table(Table&&) = default;
+    Table& operator=(Table&&) = default;
+
+    /*!
+     * \brief Look up \a key.
+     *
+     * \param key   Interned string to search for.
+     * \param value Output parameter set to the associated Value on success.
+     *
+     * \return \c true if \a key is in the table.
+     */
+    bool
+    Get(const ObjString* key, val::Value* value) const;
+
+    /*!
+     * \brief Associate \a value with \a key, overwriting any previous value.
+     *
+     * \return \c true if \a key was not already in the table.
+     */
+    bool
+    Set(ObjString* key, const val::Value& value);
+
+    /*!
+     * \brief Remove \a key from the table.
+     *
+     * \return \c true if \a key was found and removed.
+     */
+    bool
+    Delete(const ObjString* key);
+
+    /*!
+     * \brief Copy every entry of \a from into this table.
+     */
+    void
+    AddAll(const Table& from);
+
+    /*!
+     * \brief Return the key whose characters equal \a chars, if any.
+     *
+     * FindString() is the one lookup which compares keys by content. It is
+     * what the intern table uses to decide whether a string already exists.
+     *
+     * \param chars  Characters of the string to search for.
+     * \param length Number of characters in \a chars.
+     * \param hash   HashString() of \a chars.
+     *
+     * \return The matching key or \c nullptr.
+     */
+    ObjString*
+    FindString(const char* chars, std::size_t length, uint32_t hash) const;
+
+    /*!
+     * \brief Delete every entry whose key has not been marked by the GC.
+     */
+    void
+    RemoveWhite();
+
+    /*!
+     * \brief Return the slot array, including empty slots and tombstones.
+     *
+     * Callers iterating the table must skip entries with a null key.
+     */
+    const std::vector<Entry>&
+    Entries() const { return entries_; }
+
+private:
+    /*!
+     * \brief Return the index of the slot for \a key in \a entries.
+     *
+     * The returned slot either holds \a key or is the slot \a key should be
+     * inserted into: the first tombstone seen while probing, else the
+     * empty slot which ended the probe sequence. \a entries must not be
+     * empty.
+     */
+    static std::size_t
+    FindEntry(const std::vector<Entry>& entries, const ObjString* key);
+
+    /*!
+     * \brief Rehash every live entry into a new array of \a capacity slots.
+     */
+    void
+    AdjustCapacity(std::size_t capacity);
+
+    std::vector<Entry> entries_;   /*!< Slot array, its size is zero or a power of two. */
+    std::size_t        count_ = 0; /*!< Number of live entries plus tombstones. */
+}; // end Table
+} // end obj
+} // end lox
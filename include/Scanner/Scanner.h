@@ -3,6 +3,7 @@
 #include <cctype>
 #include <cstdint>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 namespace lox
@@ -78,10 +79,11 @@ public:
      * \brief Construct a token.
      *
      * \param type Token type.
-     * \param lexeme Token lexeme.
+     * \param lexeme Token lexeme. The Token only keeps a view of the
+     *               characters, they must outlive the Token.
      * \param line Line number at which this token appears in the source code.
      */
-    Token(TokenType type, const std::string& lexeme, int line);
+    Token(TokenType type, std::string_view lexeme, int line);
 
     ~Token() = default;
     Token(const Token&) = default;
@@ -102,9 +104,9 @@ public:
     GetTypeStr() const { return kTokenToStr_.at(type_); }
 
     /*!
-     * \brief Return the Token lexeme.
+     * \brief Return a view of the Token lexeme.
      */
-    std::string
+    std::string_view
     GetLexeme() const { return lexeme_; }
 
     /*!
@@ -117,9 +119,9 @@ private:
     static const std::unordered_map<TokenType, std::string>
     kTokenToStr_; /*!< Map of TokenTypes to their corresponding string representation. */
 
-    TokenType   type_;    /*!< Token type. */
-    std::string lexeme_;  /*!< Token lexeme. */
-    int         line_;    /*!< Line number at which this token appears. */
+    TokenType        type_;    /*!< Token type. */
+    std::string_view lexeme_;  /*!< View of the Token lexeme (see Token()). */
+    int              line_;    /*!< Line number at which this token appears. */
 }; // end Token
 
 /*!
@@ -127,7 +129,8 @@ private:
  * \brief The Scanner class implements the Lox lang source code scanner.
  *
  * Scanner takes as input a Lox source string and emits Token objects on
- * demand.
+ * demand. Neither the Scanner nor its Tokens copy the source: the caller
+ * owns the source text and must keep it alive while they are in use.
  */
 class Scanner
 {
@@ -139,7 +142,7 @@ public:
      *
      * \param source Lox lang source code.
      */
-    explicit Scanner(const std::string& source);
+    explicit Scanner(std::string_view source);
 
     ~Scanner() = default;
     Scanner(const Scanner&) = default;
@@ -157,10 +160,7 @@ public:
     ScanToken();
 
 private:
-    static const std::unordered_map<std::string, Token::TokenType>
-    kKeywords_; /*!< Map of keyword strings to their Token::TokenType. */
-
-    std::string
+    std::string_view
     SourceSubstring(int begin, int end) const
         { return source_.substr(begin, end - begin); }
 
@@ -198,7 +198,7 @@ private:
      * \brief Return a Token with error message \a message as the lexeme.
      */
     Token
-    ErrorToken(const std::string& message) const
+    ErrorToken(std::string_view message) const
         { return Token(Token::TokenType::kError, message, line_); }
 
     /*!
@@ -253,10 +253,30 @@ private:
     Token
     Identifier();
 
-    uint32_t    start_;   /*!< Source code start index. */
-    uint32_t    current_; /*!< Current source code index. */
-    uint32_t    line_;    /*!< Current line number. */
-    std::string source_;  /*!< Source code string. */
+    /*!
+     * \brief Return the TokenType of the identifier or keyword lexeme
+     *        being scanned.
+     *
+     * Keywords are recognized by a hand written trie: a switch on the first
+     * (and when needed the second) character selects the only candidate
+     * keyword, whose remaining characters are then compared in one go.
+     */
+    Token::TokenType
+    IdentifierType() const;
+
+    /*!
+     * \brief Return \a type if the current lexeme is \a rest preceded by
+     *        \a start already matched characters, or kIdentifier otherwise.
+     */
+    Token::TokenType
+    CheckKeyword(uint32_t start,
+                 std::string_view rest,
+                 Token::TokenType type) const;
+
+    uint32_t         start_;   /*!< Source code start index. */
+    uint32_t         current_; /*!< Current source code index. */
+    uint32_t         line_;    /*!< Current line number. */
+    std::string_view source_;  /*!< View of the caller owned source code. */
 }; // end Scanner
 } // end scanr
 } // end lox
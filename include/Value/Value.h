@@ -1,6 +1,7 @@
 #pragma once
 
-#include <memory>
+#include <cstdint>
+#include <cstring>
 #include <variant>
 
 namespace lox
@@ -15,6 +16,123 @@ namespace obj
 
 namespace val
 {
+#ifdef NAN_BOXING
+    static_assert(sizeof(void*) == sizeof(uint64_t),
+                  "NaN boxing requires 64-bit pointers.");
+
+    /* A Value is a 64-bit IEEE 754 double. Any bit pattern that is not a
+       quiet NaN is a number. Quiet NaNs with the sign bit clear encode nil
+       and the booleans in their low bits. Quiet NaNs with the sign bit set
+       carry an object pointer in their low 48 bits. */
+    static constexpr uint64_t kSignBit      = 0x8000000000000000; /*!< Sign bit, set for object pointers. */
+    static constexpr uint64_t kQuietNan     = 0x7ffc000000000000; /*!< Exponent plus quiet and Intel FP indefinite bits. */
+    static constexpr uint64_t kTagNil       = 1;                  /*!< Tag identifying nil. */
+    static constexpr uint64_t kTagFalse     = 2;                  /*!< Tag identifying false. */
+    static constexpr uint64_t kTagTrue      = 3;                  /*!< Tag identifying true. */
+    static constexpr uint64_t kTagUndefined = 4;                  /*!< Tag identifying an unset global slot. */
+
+    static constexpr uint64_t kNilBits       = kQuietNan | kTagNil;       /*!< Bit pattern of nil. */
+    static constexpr uint64_t kFalseBits     = kQuietNan | kTagFalse;     /*!< Bit pattern of false. */
+    static constexpr uint64_t kTrueBits      = kQuietNan | kTagTrue;      /*!< Bit pattern of true. */
+    static constexpr uint64_t kUndefinedBits = kQuietNan | kTagUndefined; /*!< Bit pattern of the undefined sentinel. */
+
+    /*!
+     * \struct Value
+     * \brief The Value struct is a NaN-boxed Lox built-in type.
+     */
+    struct Value
+    {
+        uint64_t bits;
+    }; // end Value
+
+    /*!
+     * \brief Convert \a value to a Value with boolean type info and data.
+     */
+    constexpr Value
+    BoolVal(bool value) { return {value ? kTrueBits : kFalseBits}; }
+
+    /*!
+     * \brief Convert \a value to a Value with nil type info and data.
+     */
+    constexpr Value
+    NilVal() { return {kNilBits}; }
+
+    /*!
+     * \brief Return the sentinel stored in global slots not yet defined.
+     *
+     * The undefined sentinel is internal to the VM, it is never visible to
+     * Lox programs.
+     */
+    constexpr Value
+    UndefinedVal() { return {kUndefinedBits}; }
+
+    /*!
+     * \brief Convert \a value to a Value with number type info and data.
+     */
+    inline Value
+    NumberVal(double value)
+    {
+        Value boxed;
+        std::memcpy(&boxed.bits, &value, sizeof(double));
+        return boxed;
+    }
+
+    /*!
+     * \brief Convert \a value to a C++ boolean type.
+     */
+    constexpr bool
+    AsBool(const Value& value) { return (value.bits == kTrueBits); }
+
+    /*!
+     * \brief Convert \a value to a C++ double.
+     */
+    inline double
+    AsNumber(const Value& value)
+    {
+        double number;
+        std::memcpy(&number, &value.bits, sizeof(double));
+        return number;
+    }
+
+    /*!
+     * \brief Return \c true if \a value represents a Lox boolean.
+     */
+    constexpr bool
+    IsBool(const Value& value) { return ((value.bits | 1) == kTrueBits); }
+
+    /*!
+     * \brief Return \c true if \a value represents Lox's nil.
+     */
+    constexpr bool
+    IsNil(const Value& value) { return (value.bits == kNilBits); }
+
+    /*!
+     * \brief Return \c true if \a value is the undefined sentinel.
+     */
+    constexpr bool
+    IsUndefined(const Value& value) { return (value.bits == kUndefinedBits); }
+
+    /*!
+     * \brief Return \c true if \a value represents a Lox number.
+     */
+    constexpr bool
+    IsNumber(const Value& value)
+        { return ((value.bits & kQuietNan) != kQuietNan); }
+
+    /*!
+     * \brief Return \c true if \a a equals \a b.
+     *
+     * Two numbers are compared as doubles so that NaN != NaN. Every other
+     * pair of values is equal only if their bit patterns are identical.
+     */
+    inline bool
+    ValuesEqual(const Value& a, const Value& b)
+    {
+        if (IsNumber(a) && IsNumber(b))
+            return (AsNumber(a) == AsNumber(b));
+        return (a.bits == b.bits);
+    }
+#else
     /*!
      * \enum ValueType
      * \brief The ValueType enum defines the built-in Lox types.
@@ -23,8 +141,9 @@ namespace val
     {
         kBool,   /*!< Boolean. */
         kNil,    /*!< Nil (i.e., NULL). */
-        kNumber, /*!< Numerical. */
-        kObj     /*!< Lox objects (e.g., strings, functions, etc.) */
+        kNumber,   /*!< Numerical. */
+        kObj,      /*!< Lox objects (e.g., strings, functions, etc.) */
+        kUndefined /*!< Sentinel marking an unset global slot. */
     }; // end ValueType
 
     /*!
@@ -34,62 +153,79 @@ namespace val
     struct Value
     {
         ValueType type;
-        std::variant<bool, double, std::shared_ptr<obj::Obj>> as;
+        std::variant<bool, double, obj::Obj*> as;
     }; // end Value
 
     /*!
      * \brief Convert \a value to a Value with boolean type info and data.
      */
-    Value
-    BoolVal(bool value);
+    inline Value
+    BoolVal(bool value) { return {ValueType::kBool, value}; }
 
     /*!
      * \brief Convert \a value to a Value with nil type info and data.
      */
-    Value
-    NilVal();
+    inline Value
+    NilVal() { return {ValueType::kNil, 0.0}; }
 
     /*!
-     * \brief Convert \a value to a Value with number type info and data.
+     * \brief Return the sentinel stored in global slots not yet defined.
+     *
+     * The undefined sentinel is internal to the VM, it is never visible to
+     * Lox programs.
      */
-    Value
-    NumberVal(double value);
+    inline Value
+    UndefinedVal() { return {ValueType::kUndefined, 0.0}; }
 
     /*!
-     * \brief Return \c true if \a a equals \a b.
+     * \brief Convert \a value to a Value with number type info and data.
      */
-    bool
-    ValuesEqual(const Value& a, const Value& b);
+    inline Value
+    NumberVal(double value) { return {ValueType::kNumber, value}; }
 
     /*!
      * \brief Convert \a value to a C++ boolean type.
      */
-    bool
-    AsBool(const Value& value);
+    inline bool
+    AsBool(const Value& value) { return std::get<bool>(value.as); }
 
     /*!
      * \brief Convert \a value to a C++ double.
      */
-    double
-    AsNumber(const Value& value);
+    inline double
+    AsNumber(const Value& value) { return std::get<double>(value.as); }
 
     /*!
      * \brief Return \c true if \a value represents a Lox boolean.
      */
-    bool
-    IsBool(const Value& value);
+    inline bool
+    IsBool(const Value& value) { return (value.type == ValueType::kBool); }
 
     /*!
      * \brief Return \c true if \a value represents Lox's nil.
      */
-    bool
-    IsNil(const Value& value);
+    inline bool
+    IsNil(const Value& value) { return (value.type == ValueType::kNil); }
+
+    /*!
+     * \brief Return \c true if \a value is the undefined sentinel.
+     */
+    inline bool
+    IsUndefined(const Value& value)
+        { return (value.type == ValueType::kUndefined); }
 
     /*!
      * \brief Return \c true if \a value represents a Lox number.
      */
+    inline bool
+    IsNumber(const Value& value) { return (value.type == ValueType::kNumber); }
+
+    /*!
+     * \brief Return \c true if \a a equals \a b.
+     */
     bool
-    IsNumber(const Value& value);
+    ValuesEqual(const Value& a, const Value& b);
+#endif
 
     /*!
      * \brief Print the Lox object stored in \a value to STDOUT.
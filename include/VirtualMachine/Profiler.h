@@ -0,0 +1,192 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+
+#include "Object.h"
+#include "Heap.h"
+
+namespace lox
+{
+namespace vm
+{
+/*!
+ * \class Profiler
+ * \brief The Profiler class accumulates the instruction counts and times
+ *        recorded by a VirtualMachine running in profile mode.
+ *
+ * The VM calls Enter() whenever it loads the active call frame and Step()
+ * before every instruction. The time between two Step() calls is charged
+ * to the first of the two instructions, so all times are self times (e.g.,
+ * a call instruction is only charged for setting up the call). Samples are
+ * kept per instruction of every function and per call path, the chain of
+ * functions of the active frames. Report() aggregates them per opcode,
+ * function and source line.
+ *
+ * The profiled functions are kept alive (see MarkRoots()) so their code can
+ * still be read once the script is done.
+ */
+class Profiler
+{
+public:
+    static constexpr std::size_t kReportRows =
+        20; /*!< Rows printed in the function and line sections of Report(). */
+
+    /* The Profiler points into its own samples so it can be neither
+       copied nor moved. */
+    Profiler() = default;
+    ~Profiler() = default;
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+    Profiler& operator=(Profiler&&) = delete;
+
+    /*!
+     * \brief Record that \a function runs in the innermost of \a depth
+     *        active call frames.
+     *
+     * Frames only change through calls and returns, so the frames below the
+     * innermost one are the ones seen by the previous calls.
+     */
+    void
+    Enter(obj::ObjFunction* function, int depth);
+
+    /*!
+     * \brief Record the execution of the instruction at \a ip in the
+     *        function of the last Enter() call.
+     */
+    void
+    Step(const uint8_t* ip)
+    {
+        Clock::time_point now = Clock::now();
+        Charge(now);
+        last_node_   = path_.back();
+        last_offset_ = static_cast<std::size_t>(ip - code_);
+        current_->counts[last_offset_]++;
+    }
+
+    /*!
+     * \brief Charge the last instruction and forget the active frames, to
+     *        be called when the VM stops running.
+     */
+    void
+    Stop();
+
+    /*!
+     * \brief Return the number of instructions executed so far.
+     */
+    uint64_t
+    GetInstructionCount() const;
+
+    /*!
+     * \brief Print the opcode, function and source line tables, sorted by
+     *        time, to \a out.
+     */
+    void
+    Report(std::FILE* out) const;
+
+    /*!
+     * \brief Write the call paths in the collapsed stack format read by
+     *        flame graph tools to the file \a path.
+     *
+     * Each line lists the functions of a call path, outermost first and
+     * separated by ';', followed by the path's self time in nanoseconds.
+     *
+     * \return \c false, after printing an error to STDERR, if the file could
+     *         not be written.
+     */
+    bool
+    WriteStacks(const std::string& path) const;
+
+    /*!
+     * \brief Mark every profiled function.
+     */
+    void
+    MarkRoots(obj::Heap& heap) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /*!
+     * \struct FunctionProfile
+     * \brief The FunctionProfile struct holds the samples of one function.
+     */
+    struct FunctionProfile
+    {
+        obj::ObjFunction*     function;  /*!< Profiled function. */
+        uint64_t              calls = 0; /*!< Number of frames pushed for the function. */
+        std::vector<uint64_t> counts;    /*!< Executions, indexed by instruction offset. */
+        std::vector<uint64_t> nanos;     /*!< Self time, indexed by instruction offset. */
+    }; // end FunctionProfile
+
+    /*!
+     * \struct PathNode
+     * \brief The PathNode struct is a node of the call path tree.
+     */
+    struct PathNode
+    {
+        int              function;  /*!< Index of the function in #functions_. */
+        int              parent;    /*!< Index of the caller's node, or -1. */
+        std::vector<int> children;  /*!< Indices of the callee nodes. */
+        uint64_t         nanos = 0; /*!< Self time of the path. */
+    }; // end PathNode
+
+    /*!
+     * \brief Charge the time elapsed since the previous call to the last
+     *        instruction stepped.
+     */
+    void
+    Charge(Clock::time_point now)
+    {
+        if (last_node_ >= 0) {
+            uint64_t nanos = static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    now - last_).count());
+            nodes_[last_node_].nanos += nanos;
+            functions_[nodes_[last_node_].function].nanos[last_offset_] +=
+                nanos;
+        }
+        last_ = now;
+    }
+
+    /*!
+     * \brief Return the node of \a function called from the node \a parent
+     *        (-1 for the outermost frame), creating it on first use.
+     */
+    int
+    Child(int parent, obj::ObjFunction* function);
+
+    /*!
+     * \brief Return the report label of the function at \a index, i.e.
+     *        its name and first line.
+     */
+    std::string
+    Label(int index) const;
+
+    /*!
+     * \brief Visit the call path tree depth first, calling \a pre before
+     *        and \a post after the children of each node with the node's
+     *        index.
+     */
+    template <typename Pre, typename Post>
+    void
+    Walk(Pre pre, Post post) const;
+
+    std::unordered_map<obj::ObjFunction*, int> indices_;   /*!< Index of each profiled function in #functions_. */
+    std::vector<FunctionProfile>               functions_; /*!< Samples of the profiled functions. */
+    std::vector<PathNode>                      nodes_;     /*!< Call path tree, a child always follows its parent. */
+    std::vector<int>                           roots_;     /*!< Nodes of the outermost frames. */
+    std::vector<int>                           path_;      /*!< Nodes of the active frames, innermost last. */
+    FunctionProfile*                           current_     = nullptr; /*!< Profile of the innermost frame. */
+    const uint8_t*                             code_        = nullptr; /*!< Code of the innermost frame. */
+    int                                        last_node_   = -1;      /*!< Node of the last instruction stepped, or -1. */
+    std::size_t                                last_offset_ = 0;       /*!< Offset of the last instruction stepped. */
+    Clock::time_point                          last_;                  /*!< Time of the last Step(). */
+}; // end Profiler
+} // end vm
+} // end lox
@@ -1,6 +1,10 @@
 #pragma once
 
+#include <algorithm>
 #include <climits>
+#include <cstddef>
+#include <memory>
+#include <utility>
 
 #include "Value.h"
 
@@ -8,61 +12,125 @@ namespace lox
 {
 namespace vm
 {
-static constexpr int kFramesMax = 64; /*!< Max number of call frames. */
-static constexpr int kStackMax  =
-    kFramesMax * (UINT8_MAX + 1);     /*!< Max number of stack elements. */
-
 /*!
- * \struct ValueStack
- * \brief The ValueStack struct defines a stack storing val::Value elements.
+ * \class ValueStack
+ * \brief The ValueStack class defines a growable stack of val::Value
+ *        elements.
+ *
+ * The stack buffer is allocated on the first call to Reserve() and
+ * reallocated when a Reserve() request does not fit. Push() never checks
+ * for overflow: the VM reserves the slots a function needs before calling
+ * it.
  */
-struct ValueStack
+class ValueStack
 {
-    val::Value  stack[kStackMax]; /*!< Stack buffer. */
-    val::Value* stack_top;        /*!< Pointer to the item at the stack top. */
-}; // end ValueStack
+public:
+    static constexpr std::size_t kMinCapacity =
+        UINT8_MAX + 1; /*!< Capacity of the first allocation. */
 
-/* Global val::Value stack utilized by the VM. Why global? Just to keep it
-   simple and in-line with the text. */
-extern struct ValueStack vm_stack;
+    ValueStack() = default;
+    ~ValueStack() = default;
+    ValueStack(const ValueStack&) = delete;
+    ValueStack& operator=(const ValueStack&) = delete;
+    ValueStack(ValueStack&&) = delete;
+    ValueStack& operator=(ValueStack&&) = delete;
 
-/*!
- * \brief Reset the stack.
- *
- * A reset sets the stack top to point at the stack base. There is no
- * actual deallocation/destruction of the Value objects stored in the stack
- * at the time ResetStack() is called.
- */
-void
-ResetStack();
+    /*!
+     * \brief Reset the stack.
+     *
+     * A reset sets the stack top to point at the stack base. There is no
+     * actual deallocation/destruction of the Value objects stored in the
+     * stack at the time Reset() is called.
+     */
+    void
+    Reset() { top_ = values_.get(); }
 
-/*!
- * \brief Push \a value onto the stack.
- */
-void
-Push(const val::Value& value);
+    /*!
+     * \brief Ensure there is room for \a count values above the stack top.
+     *
+     * Growing the stack moves its contents to a new buffer. \a relocate is
+     * called as relocate(old_base, new_base) before the old buffer is
+     * released so the caller can rebase every pointer it holds into the
+     * stack.
+     */
+    template <typename Relocate>
+    void
+    Reserve(std::size_t count, Relocate relocate);
 
-/*!
- * \brief Pop the Value at the top of the stack.
- *
- * Popping from an empty stack leads to undefined behavior.
- */
-val::Value
-Pop();
+    /*!
+     * \brief Push \a value onto the stack.
+     */
+    void
+    Push(const val::Value& value) { *top_++ = value; }
 
-/*!
- * \brief Return the value \a distance slots back from the stack top.
- *
- * Calling Peek() with an invalid \a distance argument leads to undefined
- * behavior.
- */
-val::Value
-Peek(int distance);
+    /*!
+     * \brief Pop the Value at the top of the stack.
+     *
+     * Popping from an empty stack leads to undefined behavior.
+     */
+    val::Value
+    Pop() { return *--top_; }
 
-/*!
- * \brief Print stack contents to STDOUT.
- */
+    /*!
+     * \brief Return the value \a distance slots back from the stack top.
+     *
+     * Calling Peek() with an invalid \a distance argument leads to
+     * undefined behavior.
+     */
+    val::Value
+    Peek(int distance) const { return top_[-1 - distance]; }
+
+    /*!
+     * \brief Return a pointer to the bottom slot of the stack.
+     */
+    val::Value*
+    Base() const { return values_.get(); }
+
+    /*!
+     * \brief Return a pointer one past the value at the stack top.
+     */
+    val::Value*
+    Top() const { return top_; }
+
+    /*!
+     * \brief Move the stack top to \a top, discarding the values above it.
+     */
+    void
+    SetTop(val::Value* top) { top_ = top; }
+
+    /*!
+     * \brief Print stack contents to STDOUT.
+     */
+    void
+    Print() const;
+
+private:
+    std::unique_ptr<val::Value[]> values_;         /*!< Stack buffer. */
+    std::size_t                   capacity_ = 0;   /*!< Number of slots in #values_. */
+    val::Value*                   top_ = nullptr;  /*!< Pointer to the slot past the stack top. */
+}; // end ValueStack
+
+template <typename Relocate>
 void
-PrintStack();
+ValueStack::Reserve(std::size_t count, Relocate relocate)
+{
+    std::size_t size   = top_ - values_.get();
+    std::size_t needed = size + count;
+    if (needed <= capacity_)
+        return;
+
+    std::size_t capacity = (capacity_ > 0) ? capacity_ : kMinCapacity;
+    while (capacity < needed)
+        capacity *= 2;
+
+    std::unique_ptr<val::Value[]> values(new val::Value[capacity]);
+    std::copy(values_.get(), top_, values.get());
+    if (values_)
+        relocate(values_.get(), values.get());
+
+    values_   = std::move(values);
+    capacity_ = capacity;
+    top_      = values_.get() + size;
+}
 } // end vm
 } // end lox
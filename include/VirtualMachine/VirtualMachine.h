@@ -2,13 +2,16 @@
 
 #include <memory>
 #include <string>
-#include <functional>
-#include <unordered_map>
+#include <vector>
+#include <cstddef>
 #include <cstdint>
 
 #include "Stack.h"
+#include "Profiler.h"
 #include "Value.h"
 #include "Object.h"
+#include "Heap.h"
+#include "Globals.h"
 #include "Chunk.h"
 #include "Compiler.h"
 
@@ -31,16 +34,68 @@ public:
     {
         kInterpretOk,           /*!< Successful execution. */
         kInterpretCompileError, /*!< Compilation error. */
-        kInterpretRuntimeError  /*!< Runtime error. */
+        kInterpretRuntimeError, /*!< Runtime error. */
+        kInterpretImageError    /*!< Bytecode image could not be read or written. */
     }; // end InterpretResult
 
-    VirtualMachine();
+    static constexpr std::size_t kDefaultMaxFrames =
+        1 << 16; /*!< Default call depth limit. */
 
+    /*!
+     * \brief Construct a VirtualMachine.
+     *
+     * \param gc_threshold   Allocated bytes that trigger the first GC.
+     * \param gc_grow_factor Multiplier applied to the surviving bytes after
+     *                       a GC to compute the next trigger threshold.
+     * \param max_frames     Call depth beyond which a call fails with a
+     *                       "Stack overflow." runtime error.
+     */
+    explicit VirtualMachine(
+        std::size_t gc_threshold   = obj::Heap::kDefaultGcThreshold,
+        std::size_t gc_grow_factor = obj::Heap::kDefaultGcGrowFactor,
+        std::size_t max_frames     = kDefaultMaxFrames);
+
+    /* The VM registers itself as a root source with its Heap so it can
+       be neither copied nor moved. */
     ~VirtualMachine() = default;
-    VirtualMachine(const VirtualMachine&) = default;
-    VirtualMachine& operator=(const VirtualMachine&) = default;
-    VirtualMachine(VirtualMachine&&) = default;
-    VirtualMachine& operator=(VirtualMachine&&) = default;
+    VirtualMachine(const VirtualMachine&) = delete;
+    VirtualMachine& operator=(const VirtualMachine&) = delete;
+    VirtualMachine(VirtualMachine&&) = delete;
+    VirtualMachine& operator=(VirtualMachine&&) = delete;
+
+    /*!
+     * \brief Enable or disable the compile time optimizations, i.e. constant
+     *        folding and the peephole pass over compiled code.
+     *
+     * They are enabled by default, disabling them makes their effect
+     * measurable.
+     */
+    void
+    SetOptimize(bool enabled) { optimize_ = enabled; }
+
+    /*!
+     * \brief Enable or disable profile mode.
+     *
+     * In profile mode the VM records the count and time of every executed
+     * instruction in a Profiler. Enabling it discards the samples collected
+     * so far. Profiling is disabled by default and then costs nothing: the
+     * instruction loop is compiled once with and once without the
+     * recording code.
+     */
+    void
+    SetProfile(bool enabled);
+
+    /*!
+     * \brief Return the Profiler, or \c nullptr if profile mode is off.
+     */
+    const Profiler*
+    GetProfiler() const { return profiler_.get(); }
+
+    /*!
+     * \brief Return the Heap, e.g. to read its allocation counters.
+     */
+    const obj::Heap&
+    GetHeap() const { return heap_; }
 
     /*!
      * \brief Compile and execute the code defined in \a source.
@@ -48,14 +103,22 @@ public:
     InterpretResult
     Interpret(const std::string& source);
 
+    /*!
+     * \brief Compile \a source and save the bytecode to the image file
+     *        \a path (see img::WriteImage()) instead of executing it.
+     */
+    InterpretResult
+    CompileImage(const std::string& source, const std::string& path);
+
+    /*!
+     * \brief Load the bytecode image file \a path and execute it.
+     */
+    InterpretResult
+    InterpretImage(const std::string& path);
+
 private:
-    using LoxString       = std::shared_ptr<obj::ObjString>;
-    using LoxStringMap    =
-        std::unordered_map<std::string, LoxString>;
-    using InternedStrings = std::shared_ptr<LoxStringMap>;
-    using Globals         =
-        std::unordered_map<LoxString, val::Value>;
-    using UpvaluePtr      = std::shared_ptr<obj::ObjUpvalue>;
+    using LoxString  = obj::ObjString*;
+    using UpvaluePtr = obj::ObjUpvalue*;
 
     /*!
      * \struct CallFrame
@@ -63,9 +126,9 @@ private:
      */
     struct CallFrame
     {
-        std::shared_ptr<obj::ObjClosure> closure; /*!< Lox closure object representation. */
-        int          ip;    /*!< Instruction pointer. */
-        val::Value*  slots; /*!< Frame start point on the VM's stack. */
+        obj::ObjClosure* closure; /*!< Lox closure object representation. */
+        const uint8_t*   ip;      /*!< Next instruction in the closure's chunk. */
+        val::Value*      slots;   /*!< Frame start point on the VM's stack. */
     }; // end CallFrame
 
     /*!
@@ -86,9 +149,21 @@ private:
 
     /*!
      * \brief Construct a new CallFrame and add it to the frame stack.
+     *
+     * The frame array and the value stack grow on demand so that the
+     * stack has room for every slot the callee may use.
      */
     bool
-    Call(std::shared_ptr<obj::ObjClosure> closure, int arg_count);
+    Call(obj::ObjClosure* closure, int arg_count);
+
+    /*!
+     * \brief Ensure the value stack has room for \a count more values.
+     *
+     * When the stack has to move, the slots of every active CallFrame and
+     * the locations of the open upvalues are rebased onto the new buffer.
+     */
+    void
+    EnsureStack(std::size_t count);
 
     /*!
      * \brief Forward the \a callee to the appropriate call handler.
@@ -101,36 +176,24 @@ private:
     CallValue(const val::Value& callee, int arg_count);
 
     /*!
-     * \brief Return the next byte in \a frame's chunk.
+     * \brief Return \c true if \a a equals \a b.
      *
-     * ReadByte() has the side effect of always incrementing the frame's ip to
-     * point to the next instruction in the chunk.
+     * Unlike val::ValuesEqual(), ropes are compared by their characters:
+     * they are flattened so \a a and \a b must be reachable from a root.
      */
-    uint8_t
-    ReadByte(CallFrame* frame)
-        { return frame->closure->function->chunk.GetInstruction(frame->ip++); }
-
-    /*!
-     * \brief Return a constant out of \a frame's chunk.
-     */
-    val::Value
-    ReadConstant(CallFrame* frame)
-        { return frame->closure->function->chunk.GetConstants()[ReadByte(frame)]; }
-
-    /*!
-     * \brief Return the 16-bit operand at \a frame's instruction pointer.
-     */
-    uint16_t
-    ReadShort(CallFrame* frame);
+    bool
+    ValuesEqual(const val::Value& a, const val::Value& b);
 
     /*!
-     * \brief Return the current constant as a ObjString object.
+     * \brief ValuesEqual() helper comparing objects that are not identical.
      */
-    LoxString
-    ReadString(CallFrame* frame) { return obj::AsString(ReadConstant(frame)); }
+    bool
+    StringsEqual(const val::Value& a, const val::Value& b);
 
     /*!
      * \brief Concatenate two string objects at the top of the stack.
+     *
+     * The result is a rope (see obj::ObjString) unless it is short.
      */
     void
     Concatenate();
@@ -152,24 +215,31 @@ private:
 
     /*!
      * \brief Bind a method name to the parameter class object.
+     *
+     * \param transient \c true if the bound method is called right away
+     *                  (see Chunk::OpCode::kOpGetMethod), it is then taken
+     *                  from #spare_bound_methods_ when one is available.
      */
     bool
-    BindMethod(std::shared_ptr<obj::ObjClass> klass, LoxString name);
+    BindMethod(obj::ObjClass* klass, LoxString name, bool transient = false);
 
     /*!
      * \brief Invoke a class method.
      */
     bool
     InvokeFromClass(
-        std::shared_ptr<obj::ObjClass> klass,
+        obj::ObjClass* klass,
         LoxString name,
         int arg_count);
 
     /*!
      * \brief Method invocation helper.
+     *
+     * \param cache InlineCache of the kOpInvoke instruction. On a hit, the
+     *              method is called without any name lookup.
      */
     bool
-    Invoke(LoxString name, int arg_count);
+    Invoke(LoxString name, int arg_count, Chunk::InlineCache& cache);
 
     /*!
      * \brief Close on an upvalue.
@@ -180,84 +250,90 @@ private:
     /*!
      * \brief Capture an upvalue on \a local.
      */
-    std::shared_ptr<obj::ObjUpvalue>
+    UpvaluePtr
     CaptureUpvalue(val::Value* local);
 
     /*!
-     * \brief Helper function used to evaluate binary operations.
+     * \brief Mark every object directly reachable from the VM.
      *
-     * BinaryOp() pops the two values at the top of the stack and applies
-     * the binary operation specified by \a op taking care to order the
-     * operands correctly. If the values at the top of the stack are invalid
-     * operands, a runtime error is reported.
+     * The VM's roots are the value stack, the closures of active call
+     * frames, the globals table, the open upvalue list, the interned
+     * init string and the spare bound methods.
+     */
+    void
+    MarkRoots(obj::Heap& heap);
+
+    /*!
+     * \brief Helper function used to evaluate binary numeric operations.
      *
-     * \param value_type Value conversion function applied to each operand.
-     * \param op         The binary operation opcode.
+     * BinaryOp() replaces the two numbers at the top of the stack with the
+     * Value returned by \a op(a, b), where \a b is the value at the very
+     * top. \a op is a template parameter so every call site is specialized
+     * and inlined; there is no type-erased call nor a switch on the opcode.
      *
-     * \return InterpretResult::kInterpretRuntimeError if an error occurs, else
-     *         InterpretResult::kInterpretOk is returned.
+     * \param op Callable taking two doubles and returning a val::Value.
+     *
+     * \return \c false, leaving the stack untouched, if either operand is not
+     *         a number. Reporting the error is left to the caller.
+     */
+    template <typename Op>
+    bool
+    BinaryOp(Op op);
+
+    /*!
+     * \brief Wrap the top level \a function in a closure and run it.
      */
-    template <typename T>
     InterpretResult
-    BinaryOp(
-        std::function<val::Value(T)> value_type,
-        Chunk::OpCode op);
+    Execute(obj::ObjFunction* function);
 
     /*!
      * \brief Execute the bytecode within the active CallFrame.
+     *
+     * \tparam kProfile \c true to report every instruction and frame
+     *                  change to #profiler_.
      */
+    template <bool kProfile>
     InterpretResult
     Run();
 
     /* Note, this is a stacked based virtual machine meaning values are
-       stored on a stack as the User program is executed. VirtualMachine
-       implements its stack and defines a handle to it in Stack.h */
-    InternedStrings interned_strs_;      /*!< Collection of interned strings. */
-    Globals         globals_;            /*!< Map of global names to their associated Value. */
-    CallFrame       frames_[kFramesMax]; /*!< Stack of function call frames. */
-    int             frame_count;    /*!< Number of frames currently in the #frames_ array. */
-    UpvaluePtr      open_upvalues_; /*!< Singly linked list of open upvalues. */
-    LoxString       init_string_;   /*!< Interned string for class init() method. */
+       stored on a stack as the User program is executed. The stack and the
+       frame array belong to the VirtualMachine instance and both grow on
+       demand. */
+    obj::Heap              heap_;          /*!< Owner of all Lox objects and interned strings. */
+    obj::Globals           globals_;       /*!< Global variables, indexed by the slots assigned by the Compiler. */
+    ValueStack             stack_;         /*!< Value stack shared by all call frames. */
+    std::vector<CallFrame> frames_;        /*!< Stack of function call frames, its size is the deepest call depth reached so far. */
+    int                    frame_count;    /*!< Number of active frames in the #frames_ array. */
+    std::size_t            max_frames_;    /*!< Call depth limit. */
+    UpvaluePtr             open_upvalues_; /*!< Singly linked list of open upvalues. */
+    LoxString              init_string_;   /*!< Interned string for class init() method. */
+    bool                   optimize_;      /*!< Optimize compiled code. */
+    std::vector<obj::ObjBoundMethod*> spare_bound_methods_; /*!< Called transient bound methods, reused by kOpGetMethod. */
+    std::unique_ptr<Profiler> profiler_;   /*!< Samples of profile mode, nullptr when it is off. */
 }; // end VirtualMachine
 
-template <typename T>
-VirtualMachine::InterpretResult
-VirtualMachine::BinaryOp(
-    std::function<val::Value(T)> value_type,
-    Chunk::OpCode op)
+inline bool
+VirtualMachine::ValuesEqual(const val::Value& a, const val::Value& b)
 {
-    if (!val::IsNumber(Peek(0)) ||
-        !val::IsNumber(Peek(1))) {
-        RuntimeError("Operands must be numbers.");
-        return InterpretResult::kInterpretRuntimeError;
-    }
-
-    double b = val::AsNumber(Pop());
-    double a = val::AsNumber(Pop());
-    switch (op) {
-        case Chunk::OpCode::kOpAdd:
-            Push(value_type(a + b));
-            break;
-        case Chunk::OpCode::kOpSubtract:
-            Push(value_type(a - b));
-            break;
-        case Chunk::OpCode::kOpMultiply:
-            Push(value_type(a * b));
-            break;
-        case Chunk::OpCode::kOpDivide:
-            Push(value_type(a / b));
-            break;
-        case Chunk::OpCode::kOpGreater:
-            Push(value_type(a > b));
-            break;
-        case Chunk::OpCode::kOpLess:
-            Push(value_type(a < b));
-            break;
-        default:
-            RuntimeError("Unknown opcode");
-            return InterpretResult::kInterpretRuntimeError;
-    }
-    return InterpretResult::kInterpretOk;
+    if (val::ValuesEqual(a, b))
+        return true;
+    return (obj::IsObject(a) && obj::IsObject(b) && StringsEqual(a, b));
+}
+
+template <typename Op>
+bool
+VirtualMachine::BinaryOp(Op op)
+{
+    val::Value* top = stack_.Top();
+    val::Value  b   = top[-1];
+    val::Value  a   = top[-2];
+    if (!val::IsNumber(a) || !val::IsNumber(b))
+        return false;
+
+    top[-2] = op(val::AsNumber(a), val::AsNumber(b));
+    stack_.SetTop(top - 1);
+    return true;
 }
 } // end vm
 } // end lox
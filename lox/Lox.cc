@@ -1,11 +1,13 @@
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <vector>
 #include <sstream>
 #include <fstream>
 #include <iostream>
 
 #include "VirtualMachine.h"
+#include "Image.h"
 
 /*!
  * \enum LoxExitCode
@@ -15,38 +17,49 @@ enum LoxExitCode
 {
     kSuccess           = 0,  /*!< Indicates the interpreter exited gracefully. */
     kInvalidUsage      = 64, /*!< Indicates the interpreter was called with invalid arguments. */
-    kInvalidScriptPath = 74, /*!< Indicates a nonexistent/invalid script path was specified by the User. */
+    kInvalidScriptPath = 74, /*!< Indicates a nonexistent/invalid script or image path was specified by the User. */
     kCompileError      = 65, /*!< Indicates a compile time error. */
     kRuntimeError      = 70  /*!< Indicates a runtime error. */
 };
 
-static lox::vm::VirtualMachine::InterpretResult
-Interpret(const std::string& source)
-{
-    /* The VM is a static object meaning its state persists throughout the life
-       of the interpreter program. The latter is intentional and useful
-       especially in the case of the REPL where we interpret lines of source
-       code one at a time (i.e., call Interpret() repeatedly with the
-       expectation the VM 'remembers' the code last executed). */
-    static lox::vm::VirtualMachine vm;
-    return vm.Interpret(source);
-}
-
+/* A VirtualMachine holds all of the interpreter state so main() owns one
+   for the life of the program. The latter is intentional and useful
+   especially in the case of the REPL where we interpret lines of source
+   code one at a time (i.e., call Interpret() repeatedly with the
+   expectation the VM 'remembers' the code last executed). */
 static void
-Repl()
+Repl(lox::vm::VirtualMachine& vm)
 {
     const std::string kPrompt = "lox >>> ";
     std::printf("%s", kPrompt.c_str());
 
     std::string line;
     while (std::getline(std::cin, line)) {
-        Interpret(line);
+        vm.Interpret(line);
         std::printf("%s", kPrompt.c_str());
     }
 }
 
+/*!
+ * \brief Exit with the code matching a failed interpreter \a result.
+ */
 static void
-RunFile(const std::string& script)
+ExitOnError(lox::vm::VirtualMachine::InterpretResult result)
+{
+    using InterpretResult = lox::vm::VirtualMachine::InterpretResult;
+    if (InterpretResult::kInterpretCompileError == result)
+        exit(LoxExitCode::kCompileError);
+    if (InterpretResult::kInterpretRuntimeError == result)
+        exit(LoxExitCode::kRuntimeError);
+    if (InterpretResult::kInterpretImageError == result)
+        exit(LoxExitCode::kInvalidScriptPath);
+}
+
+/*!
+ * \brief Read the whole script file \a script.
+ */
+static std::string
+ReadScript(const std::string& script)
 {
     std::ifstream script_fd(script);
     if (!script_fd.is_open()) {
@@ -58,24 +71,110 @@ RunFile(const std::string& script)
     /* Read the User script in one fell swoop. */
     std::stringstream buffer;
     buffer << script_fd.rdbuf();
+    return buffer.str();
+}
 
-    using InterpretResult = lox::vm::VirtualMachine::InterpretResult;
-    InterpretResult result = Interpret(buffer.str());
-    if (InterpretResult::kInterpretCompileError == result)
-        exit(LoxExitCode::kCompileError);
-    if (InterpretResult::kInterpretRuntimeError == result)
-        exit(LoxExitCode::kRuntimeError);
+/* A script path may name either Lox source or a bytecode image produced
+   by CompileFile(), images are recognized by their magic bytes. */
+static lox::vm::VirtualMachine::InterpretResult
+RunFile(lox::vm::VirtualMachine& vm, const std::string& script)
+{
+    if (lox::img::IsImage(script))
+        return vm.InterpretImage(script);
+    return vm.Interpret(ReadScript(script));
+}
+
+static lox::vm::VirtualMachine::InterpretResult
+CompileFile(lox::vm::VirtualMachine& vm,
+            const std::string& script,
+            const std::string& image)
+{
+    return vm.CompileImage(ReadScript(script), image);
+}
+
+/*!
+ * \brief Print the profile report to STDERR, so it does not mix with the
+ *        script's output, and write the collapsed stacks to \a stacks
+ *        unless it is empty.
+ */
+static void
+ReportProfile(const lox::vm::VirtualMachine& vm, const std::string& stacks)
+{
+    const lox::vm::Profiler* profiler = vm.GetProfiler();
+    profiler->Report(stderr);
+
+    const lox::obj::Heap& heap = vm.GetHeap();
+    const lox::obj::Heap::Stats& stats = heap.GetStats();
+    std::fprintf(stderr,
+                 "\nheap: %llu objects allocated (%.3f MB), %llu freed, "
+                 "%llu collections, %.3f MB pooled\n",
+                 static_cast<unsigned long long>(stats.allocations),
+                 static_cast<double>(stats.allocated_bytes) / 1e6,
+                 static_cast<unsigned long long>(stats.frees),
+                 static_cast<unsigned long long>(stats.collections),
+                 static_cast<double>(heap.PoolBytes()) / 1e6);
+    if (!stacks.empty() && !profiler->WriteStacks(stacks))
+        exit(LoxExitCode::kInvalidScriptPath);
+}
+
+static void
+Usage()
+{
+    std::fprintf(stderr,
+                 "usage: lox [options] [script_path]\n"
+                 "       lox [options] --compile script_path -o image_path\n"
+                 "options:\n"
+                 "  --no-optimize       disable constant folding and the "
+                 "peephole pass\n"
+                 "  --profile[=stacks]  report the time spent per opcode, "
+                 "function and line\n"
+                 "                      on exit, and write collapsed stacks "
+                 "to the file stacks\n");
+    exit(LoxExitCode::kInvalidUsage);
 }
 
 int main(int argc, char** argv)
 {
-    if (1 == argc) {
-        Repl();
-    } else if (2 == argc) {
-        RunFile(argv[1]);
+    lox::vm::VirtualMachine vm;
+
+    /* Options come first, the remaining arguments select the mode. */
+    const std::string kProfile = "--profile";
+    std::vector<std::string> args(argv + 1, argv + argc);
+    std::size_t arg = 0;
+    bool profile = false;
+    std::string stacks;
+    for (; arg < args.size(); ++arg) {
+        if (args[arg] == "--no-optimize") {
+            vm.SetOptimize(false);
+        } else if (args[arg] == kProfile) {
+            profile = true;
+        } else if (0 == args[arg].compare(0, kProfile.size() + 1,
+                                          kProfile + "=")) {
+            profile = true;
+            stacks  = args[arg].substr(kProfile.size() + 1);
+        } else {
+            break;
+        }
+    }
+    args.erase(args.begin(), args.begin() + arg);
+    vm.SetProfile(profile);
+
+    using InterpretResult = lox::vm::VirtualMachine::InterpretResult;
+    InterpretResult result = InterpretResult::kInterpretOk;
+    if (args.empty()) {
+        Repl(vm);
+    } else if (1 == args.size()) {
+        result = RunFile(vm, args[0]);
+    } else if ((4 == args.size()) && (args[0] == "--compile") &&
+               (args[2] == "-o")) {
+        result = CompileFile(vm, args[1], args[3]);
     } else {
-        std::fprintf(stderr, "usage: lox [script_path]\n");
-        exit(LoxExitCode::kInvalidUsage);
+        Usage();
     }
+
+    /* Errors are profiled too, the report comes first. */
+    if (profile)
+        ReportProfile(vm, stacks);
+    ExitOnError(result);
     exit(LoxExitCode::kSuccess);
 }
@@ -12,6 +12,7 @@ Help()
     echo "options:"
     echo -e "\td    Build project documentation (default OFF)."
     echo -e "\tg    Enable debug info (default OFF)."
+    echo -e "\tn    Use NaN-boxed 8-byte values (default OFF)."
     echo -e "\th    Print this help message."
 }
 
@@ -19,14 +20,16 @@ BUILD_DOC="OFF"
 BUILD_TYPE="RELEASE"
 DEBUG_PRINT_CODE="OFF"
 DEBUG_TRACE_EXECUTION="OFF"
+NAN_BOXING="OFF"
 
-while getopts ":hdg" flag
+while getopts ":hdgn" flag
 do
     case "${flag}" in
         d) BUILD_DOC="ON";;
         g) BUILD_TYPE="DEBUG"
            DEBUG_PRINT_CODE="ON"
            DEBUG_TRACE_EXECUTION="ON";;
+        n) NAN_BOXING="ON";;
         h) Help
            exit;;
        \?) echo "Error: Invalid option"
@@ -50,7 +53,8 @@ pushd $LOX_BUILD_DIR
           -DBUILD_DOC=${BUILD_DOC}                            \
           -DCMAKE_BUILD_TYPE=${BUILD_TYPE}                    \
           -DDEBUG_PRINT_CODE=${DEBUG_PRINT_CODE}              \
-          -DDEBUG_TRACE_EXECUTION=${DEBUG_TRACE_EXECUTION} && \
+          -DDEBUG_TRACE_EXECUTION=${DEBUG_TRACE_EXECUTION}    \
+          -DNAN_BOXING=${NAN_BOXING}                          && \
     make -j$(nproc) all                                    && \
     make install
 
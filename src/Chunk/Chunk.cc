@@ -1,5 +1,6 @@
 #include <new>
-#include <memory>
+#include <algorithm>
+#include <iterator>
 #include <string>
 #include <cstdio>
 #include <cstdlib>
@@ -15,10 +16,11 @@ std::size_t
 Chunk::DisassembleInstruction(int offset) const
 {
     std::printf("%04d ", offset);
-    if ((offset > 0) && (lines_[offset] == lines_[offset - 1]))
+    int line = GetLine(offset);
+    if ((offset > 0) && (line == GetLine(offset - 1)))
         std::printf("   | ");
     else
-        std::printf("%4d ", lines_[offset]);
+        std::printf("%4d ", line);
 
     uint8_t instruction = code_[offset];
     switch (instruction) {
@@ -36,10 +38,16 @@ Chunk::DisassembleInstruction(int offset) const
             return DisassembleSimpleInstruction("OP_FALSE", offset);
         case OpCode::KOpEqual:
             return DisassembleSimpleInstruction("OP_EQUAL", offset);
+        case OpCode::kOpNotEqual:
+            return DisassembleSimpleInstruction("OP_NOT_EQUAL", offset);
          case OpCode::kOpGreater:
             return DisassembleSimpleInstruction("OP_GREATER", offset);
+        case OpCode::kOpGreaterEqual:
+            return DisassembleSimpleInstruction("OP_GREATER_EQUAL", offset);
         case OpCode::kOpLess:
             return DisassembleSimpleInstruction("OP_LESS", offset);
+        case OpCode::kOpLessEqual:
+            return DisassembleSimpleInstruction("OP_LESS_EQUAL", offset);
         case OpCode::kOpNegate:
             return DisassembleSimpleInstruction("OP_NEGATE", offset);
         case OpCode::kOpAdd:
@@ -55,11 +63,11 @@ Chunk::DisassembleInstruction(int offset) const
         case OpCode::kOpPop:
             return DisassembleSimpleInstruction("OP_POP", offset);
         case OpCode::kOpDefineGlobal:
-            return DisassembleConstantInstruction("OP_DEFINE_GLOBAL", offset);
+            return DisassembleShortInstruction("OP_DEFINE_GLOBAL", offset);
         case OpCode::kOpGetGlobal:
-           return DisassembleConstantInstruction("OP_GET_GLOBAL", offset);
+            return DisassembleShortInstruction("OP_GET_GLOBAL", offset);
         case OpCode::kOpSetGlobal:
-            return DisassembleConstantInstruction("OP_SET_GLOBAL", offset);
+            return DisassembleShortInstruction("OP_SET_GLOBAL", offset);
         case OpCode::kOpGetLocal:
             return DisassembleByteInstruction("OP_GET_LOCAL", offset);
         case OpCode::kOpSetLocal:
@@ -72,23 +80,8 @@ Chunk::DisassembleInstruction(int offset) const
             return DisassembleJumpInstruction("OP_LOOP", -1, offset);
         case OpCode::kOpCall:
             return DisassembleByteInstruction("OP_CALL", offset);
-        case OpCode::kOpClosure: {
-             offset++;
-             uint8_t constant = code_[offset++];
-             std::printf("%-16s %4d ", "OP_CLOSURE", constant);
-             val::PrintValue(constants_[constant]);
-             std::printf("\n");
-
-             std::shared_ptr<obj::ObjFunction> function =
-                obj::AsFunction(constants_[constant]);
-             for (int j = 0; j < function->upvalue_count; ++j) {
-                 int is_local = code_[offset++];
-                 int index    = code_[offset++];
-                 std::printf("%04d      |                     %s %d\n",
-                    offset - 2, is_local ? "local" : "upvalue", index);
-                }
-             return offset;
-        }
+        case OpCode::kOpClosure:
+            return DisassembleClosureInstruction("OP_CLOSURE", offset, 1);
         case OpCode::kOpGetUpvalue:
             return DisassembleByteInstruction("OP_GET_UPVALUE", offset);
         case OpCode::kOpSetUpvalue:
@@ -98,19 +91,75 @@ Chunk::DisassembleInstruction(int offset) const
         case OpCode::kOpClass:
             return DisassembleConstantInstruction("OP_CLASS", offset);
         case OpCode::kOpSetProperty:
-            return DisassembleConstantInstruction("OP_SET_PROPERTY", offset);
+            return DisassemblePropertyInstruction("OP_SET_PROPERTY", offset,
+                                                  false);
         case OpCode::kOpGetProperty:
-            return DisassembleConstantInstruction("OP_GET_PROPERTY", offset);
+            return DisassemblePropertyInstruction("OP_GET_PROPERTY", offset,
+                                                  false);
         case OpCode::kOpMethod:
             return DisassembleConstantInstruction("OP_METHOD", offset);
         case OpCode::kOpInvoke:
-            return DisassembleInvokeInstruction("OP_INVOKE", offset);
+            return DisassemblePropertyInstruction("OP_INVOKE", offset, true);
         case OpCode::kOpInherit:
             return DisassembleSimpleInstruction("OP_INHERIT", offset);
         case OpCode::kOpGetSuper:
             return DisassembleConstantInstruction("OP_GET_SUPER", offset);
         case OpCode::kOpSuperInvoke:
             return DisassembleInvokeInstruction("OP_SUPER_INVOKE", offset);
+        case OpCode::kOpConstantLong:
+            return DisassembleConstantInstruction("OP_CONSTANT_LONG", offset,
+                                                  3);
+        case OpCode::kOpDefineGlobalLong:
+            return DisassembleLongInstruction("OP_DEFINE_GLOBAL_LONG", offset);
+        case OpCode::kOpGetGlobalLong:
+            return DisassembleLongInstruction("OP_GET_GLOBAL_LONG", offset);
+        case OpCode::kOpSetGlobalLong:
+            return DisassembleLongInstruction("OP_SET_GLOBAL_LONG", offset);
+        case OpCode::kOpGetLocalLong:
+            return DisassembleLongInstruction("OP_GET_LOCAL_LONG", offset);
+        case OpCode::kOpSetLocalLong:
+            return DisassembleLongInstruction("OP_SET_LOCAL_LONG", offset);
+        case OpCode::kOpClosureLong:
+            return DisassembleClosureInstruction("OP_CLOSURE_LONG", offset, 3);
+        case OpCode::kOpClassLong:
+            return DisassembleConstantInstruction("OP_CLASS_LONG", offset, 3);
+        case OpCode::kOpSetPropertyLong:
+            return DisassemblePropertyInstruction("OP_SET_PROPERTY_LONG",
+                                                  offset, false, 3);
+        case OpCode::kOpGetPropertyLong:
+            return DisassemblePropertyInstruction("OP_GET_PROPERTY_LONG",
+                                                  offset, false, 3);
+        case OpCode::kOpMethodLong:
+            return DisassembleConstantInstruction("OP_METHOD_LONG", offset, 3);
+        case OpCode::kOpInvokeLong:
+            return DisassemblePropertyInstruction("OP_INVOKE_LONG", offset,
+                                                  true, 3);
+        case OpCode::kOpGetSuperLong:
+            return DisassembleConstantInstruction("OP_GET_SUPER_LONG", offset,
+                                                  3);
+        case OpCode::kOpSuperInvokeLong:
+            return DisassembleInvokeInstruction("OP_SUPER_INVOKE_LONG", offset,
+                                                3);
+        case OpCode::kOpGetMethod:
+            return DisassemblePropertyInstruction("OP_GET_METHOD", offset,
+                                                  false, 1);
+        case OpCode::kOpGetMethodLong:
+            return DisassemblePropertyInstruction("OP_GET_METHOD_LONG",
+                                                  offset, false, 3);
+        case OpCode::kOpJumpIfTrue:
+            return DisassembleJumpInstruction("OP_JUMP_IF_TRUE", 1, offset);
+        case OpCode::kOpGetLocalGetLocal:
+            return DisassembleLocalSuperInstruction("OP_GET_LOCAL_GET_LOCAL",
+                                                    offset);
+        case OpCode::kOpGetLocalConstantAdd:
+            return DisassembleLocalSuperInstruction(
+                "OP_GET_LOCAL_CONSTANT_ADD", offset);
+        case OpCode::kOpGetLocalGetProperty:
+            return DisassembleLocalSuperInstruction(
+                "OP_GET_LOCAL_GET_PROPERTY", offset);
+        case OpCode::kOpLessJumpIfFalse:
+            return DisassembleJumpInstruction("OP_LESS_JUMP_IF_FALSE", 1,
+                                              offset);
         default:
             std::fprintf(stderr, "unknown opcode %d\n", instruction);
             return (offset + 1);
@@ -124,18 +173,27 @@ Chunk::DisassembleSimpleInstruction(const std::string& name, int offset) const
     return (offset + 1);
 }
 
+uint32_t
+Chunk::ReadOperand(int offset, int width) const
+{
+    uint32_t operand = 0;
+    for (int i = 0; i < width; ++i)
+        operand = (operand << 8) | code_[offset + i];
+    return operand;
+}
+
 std::size_t
 Chunk::DisassembleConstantInstruction(const std::string& name,
-                                      int offset) const
+                                      int offset,
+                                      int width) const
 {
-    uint8_t constant = code_[offset + 1];
-    std::printf("%-16s %4d '", name.c_str(), constant);
+    uint32_t constant = ReadOperand(offset + 1, width);
+    std::printf("%-16s %4u '", name.c_str(), constant);
     val::PrintValue(constants_[constant]);
     std::printf("'\n");
 
-    /* Note we add 2 not 1 on return because the constant instruction is
-       2 bytes long. */
-    return (offset + 2);
+    /* The opcode is followed by a width byte constant index. */
+    return (offset + 1 + width);
 }
 
 std::size_t
@@ -147,6 +205,69 @@ Chunk::DisassembleByteInstruction(const std::string& name, int offset) const
     return (offset + 2);
 }
 
+std::size_t
+Chunk::DisassembleLocalSuperInstruction(const std::string& name,
+                                        int offset) const
+{
+    uint8_t slot = code_[offset + 1];
+    std::printf("%-16s %4d ", name.c_str(), slot);
+    switch (code_[offset]) {
+        case OpCode::kOpGetLocalGetLocal:
+            std::printf("%4d\n", code_[offset + 2]);
+            return (offset + 3);
+        case OpCode::kOpGetLocalConstantAdd:
+            std::printf("%4d '", code_[offset + 2]);
+            val::PrintValue(constants_[code_[offset + 2]]);
+            std::printf("'\n");
+            return (offset + 3);
+        default:
+            /* kOpGetLocalGetProperty */
+            std::printf("%4d '", code_[offset + 2]);
+            val::PrintValue(constants_[code_[offset + 2]]);
+            std::printf("' ic %u\n", ReadOperand(offset + 3, 2));
+            return (offset + 5);
+    }
+}
+
+std::size_t
+Chunk::DisassembleShortInstruction(const std::string& name, int offset) const
+{
+    uint16_t operand = static_cast<uint16_t>(code_[offset + 1] << 8);
+    operand |= code_[offset + 2];
+    std::printf("%-16s %4d\n", name.c_str(), operand);
+    return (offset + 3);
+}
+
+std::size_t
+Chunk::DisassembleLongInstruction(const std::string& name, int offset) const
+{
+    std::printf("%-16s %4u\n", name.c_str(), ReadOperand(offset + 1, 3));
+    return (offset + 4);
+}
+
+std::size_t
+Chunk::DisassembleClosureInstruction(const std::string& name,
+                                     int offset,
+                                     int width) const
+{
+    uint32_t constant = ReadOperand(offset + 1, width);
+    offset += 1 + width;
+    std::printf("%-16s %4u ", name.c_str(), constant);
+    val::PrintValue(constants_[constant]);
+    std::printf("\n");
+
+    /* Each upvalue is described by an is_local byte and a 24-bit index. */
+    const obj::ObjFunction* function = obj::AsFunction(constants_[constant]);
+    for (int j = 0; j < function->upvalue_count; ++j) {
+        int      is_local = code_[offset];
+        uint32_t index    = ReadOperand(offset + 1, 3);
+        std::printf("%04d      |                     %s %u\n",
+                    offset, is_local ? "local" : "upvalue", index);
+        offset += 4;
+    }
+    return offset;
+}
+
 std::size_t
 Chunk::DisassembleJumpInstruction(const std::string& name,
                                   int sign,
@@ -160,29 +281,87 @@ Chunk::DisassembleJumpInstruction(const std::string& name,
 }
 
 std::size_t
-Chunk::DisassembleInvokeInstruction(const std::string& name, int offset) const
+Chunk::DisassembleInvokeInstruction(const std::string& name,
+                                    int offset,
+                                    int width) const
 {
-    uint8_t constant  = code_[offset + 1];
-    uint8_t arg_count = code_[offset + 2];
+    uint32_t constant  = ReadOperand(offset + 1, width);
+    uint8_t  arg_count = code_[offset + 1 + width];
 
-    std::printf("%-16s (%d args) %4d '", name.c_str(), arg_count, constant);
+    std::printf("%-16s (%d args) %4u '", name.c_str(), arg_count, constant);
     val::PrintValue(constants_[constant]);
     std::printf("'\n");
-    return offset + 3;
+    return offset + 2 + width;
+}
+
+std::size_t
+Chunk::DisassemblePropertyInstruction(const std::string& name,
+                                      int offset,
+                                      bool has_args,
+                                      int width) const
+{
+    uint32_t constant = ReadOperand(offset + 1, width);
+    int      next     = offset + 1 + width;
+    if (has_args) {
+        std::printf("%-16s (%d args) %4u '", name.c_str(), code_[next],
+                    constant);
+        next++;
+    } else {
+        std::printf("%-16s %4u '", name.c_str(), constant);
+    }
+    val::PrintValue(constants_[constant]);
+
+    uint16_t cache = static_cast<uint16_t>(code_[next] << 8);
+    cache |= code_[next + 1];
+    std::printf("' ic %d\n", cache);
+    return (next + 2);
 }
 
 void
 Chunk::Write(uint8_t byte, int line)
 {
     try {
+        if (lines_.empty() || (lines_.back().line != line))
+            lines_.push_back({static_cast<int>(code_.size()), line});
         code_.push_back(byte);
-        lines_.push_back(line);
     } catch (const std::bad_alloc& e) {
         std::fprintf(stderr, "error: %s\n", e.what());
         exit(EXIT_FAILURE);
     }
 }
 
+void
+Chunk::Write(const uint8_t* bytes, std::size_t count, int line)
+{
+    try {
+        if ((count > 0) && (lines_.empty() || (lines_.back().line != line)))
+            lines_.push_back({static_cast<int>(code_.size()), line});
+        code_.insert(code_.end(), bytes, bytes + count);
+    } catch (const std::bad_alloc& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+}
+
+void
+Chunk::Truncate(std::size_t size)
+{
+    code_.resize(std::min(size, code_.size()));
+    while (!lines_.empty() &&
+           (static_cast<std::size_t>(lines_.back().start) >= code_.size()))
+        lines_.pop_back();
+}
+
+int
+Chunk::GetLine(int offset) const
+{
+    /* Find the last run starting at or before offset. */
+    auto run = std::upper_bound(
+        lines_.begin(), lines_.end(), offset,
+        [](int value, const LineRun& r) { return (value < r.start); });
+    return (run == lines_.begin()) ? 0 : std::prev(run)->line;
+}
+
 int
 Chunk::AddConstant(const val::Value& value)
 {
@@ -195,6 +374,556 @@ Chunk::AddConstant(const val::Value& value)
     }
 }
 
+std::size_t
+Chunk::AddInlineCache()
+{
+    try {
+        caches_.emplace_back();
+        return (caches_.size() - 1);
+    } catch (const std::bad_alloc& e) {
+        std::fprintf(stderr, "error: %s\n", e.what());
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Names of the opcodes, in Chunk::OpCode declaration order. */
+static const char* const kOpCodeNames[] = {
+    "OP_CONSTANT",
+    "OP_RETURN",
+    "OP_NIL",
+    "OP_TRUE",
+    "OP_FALSE",
+    "OP_EQUAL",
+    "OP_NOT_EQUAL",
+    "OP_GREATER",
+    "OP_GREATER_EQUAL",
+    "OP_LESS",
+    "OP_LESS_EQUAL",
+    "OP_NOT",
+    "OP_NEGATE",
+    "OP_ADD",
+    "OP_SUBTRACT",
+    "OP_MULTIPLY",
+    "OP_DIVIDE",
+    "OP_PRINT",
+    "OP_POP",
+    "OP_DEFINE_GLOBAL",
+    "OP_GET_GLOBAL",
+    "OP_SET_GLOBAL",
+    "OP_GET_LOCAL",
+    "OP_SET_LOCAL",
+    "OP_JUMP_IF_FALSE",
+    "OP_JUMP",
+    "OP_LOOP",
+    "OP_CALL",
+    "OP_CLOSURE",
+    "OP_GET_UPVALUE",
+    "OP_SET_UPVALUE",
+    "OP_CLOSE_UPVALUE",
+    "OP_CLASS",
+    "OP_SET_PROPERTY",
+    "OP_GET_PROPERTY",
+    "OP_METHOD",
+    "OP_INVOKE",
+    "OP_INHERIT",
+    "OP_GET_SUPER",
+    "OP_SUPER_INVOKE",
+    "OP_CONSTANT_LONG",
+    "OP_DEFINE_GLOBAL_LONG",
+    "OP_GET_GLOBAL_LONG",
+    "OP_SET_GLOBAL_LONG",
+    "OP_GET_LOCAL_LONG",
+    "OP_SET_LOCAL_LONG",
+    "OP_CLOSURE_LONG",
+    "OP_CLASS_LONG",
+    "OP_SET_PROPERTY_LONG",
+    "OP_GET_PROPERTY_LONG",
+    "OP_METHOD_LONG",
+    "OP_INVOKE_LONG",
+    "OP_GET_SUPER_LONG",
+    "OP_SUPER_INVOKE_LONG",
+    "OP_GET_METHOD",
+    "OP_GET_METHOD_LONG",
+    "OP_JUMP_IF_TRUE",
+    "OP_GET_LOCAL_GET_LOCAL",
+    "OP_GET_LOCAL_CONSTANT_ADD",
+    "OP_GET_LOCAL_GET_PROPERTY",
+    "OP_LESS_JUMP_IF_FALSE"
+};
+static_assert(sizeof(kOpCodeNames) / sizeof(kOpCodeNames[0]) ==
+              Chunk::OpCode::kOpLessJumpIfFalse + 1,
+              "Opcode names are out of sync with Chunk::OpCode.");
+
+const char*
+Chunk::GetOpCodeName(uint8_t op)
+{
+    if (op >= sizeof(kOpCodeNames) / sizeof(kOpCodeNames[0]))
+        return "OP_UNKNOWN";
+    return kOpCodeNames[op];
+}
+
+std::size_t
+Chunk::InstructionSize(int offset) const
+{
+    switch (code_[offset]) {
+        case OpCode::kOpConstant:
+        case OpCode::kOpGetLocal:
+        case OpCode::kOpSetLocal:
+        case OpCode::kOpCall:
+        case OpCode::kOpGetUpvalue:
+        case OpCode::kOpSetUpvalue:
+        case OpCode::kOpClass:
+        case OpCode::kOpMethod:
+        case OpCode::kOpGetSuper:
+            return 2;
+        case OpCode::kOpDefineGlobal:
+        case OpCode::kOpGetGlobal:
+        case OpCode::kOpSetGlobal:
+        case OpCode::kOpJumpIfFalse:
+        case OpCode::kOpJumpIfTrue:
+        case OpCode::kOpJump:
+        case OpCode::kOpLoop:
+        case OpCode::kOpSuperInvoke:
+        case OpCode::kOpGetLocalGetLocal:
+        case OpCode::kOpGetLocalConstantAdd:
+        case OpCode::kOpLessJumpIfFalse:
+            return 3;
+        case OpCode::kOpConstantLong:
+        case OpCode::kOpDefineGlobalLong:
+        case OpCode::kOpGetGlobalLong:
+        case OpCode::kOpSetGlobalLong:
+        case OpCode::kOpGetLocalLong:
+        case OpCode::kOpSetLocalLong:
+        case OpCode::kOpClassLong:
+        case OpCode::kOpMethodLong:
+        case OpCode::kOpGetSuperLong:
+        case OpCode::kOpGetProperty:
+        case OpCode::kOpSetProperty:
+        case OpCode::kOpGetMethod:
+            return 4;
+        case OpCode::kOpInvoke:
+        case OpCode::kOpSuperInvokeLong:
+        case OpCode::kOpGetLocalGetProperty:
+            return 5;
+        case OpCode::kOpGetPropertyLong:
+        case OpCode::kOpSetPropertyLong:
+        case OpCode::kOpGetMethodLong:
+            return 6;
+        case OpCode::kOpInvokeLong:
+            return 7;
+        case OpCode::kOpClosure:
+        case OpCode::kOpClosureLong: {
+            int width = (code_[offset] == OpCode::kOpClosure) ? 1 : 3;
+            const obj::ObjFunction* function =
+                obj::AsFunction(constants_[ReadOperand(offset + 1, width)]);
+            /* Each upvalue is described by an is_local byte and a 24-bit
+               index. */
+            return 1 + width + 4 * function->upvalue_count;
+        }
+        default:
+            return 1;
+    }
+}
+
+int
+Chunk::MaxStackSlots(int base) const
+{
+    /* The Compiler only emits structured control flow: every jump target
+       is reached with the same stack depth from all of its predecessors
+       and backward jumps only target code that was already visited. A
+       single linear pass is therefore enough, provided the depth recorded
+       at a forward jump is carried over to its target. */
+    std::vector<int> target_depth(code_.size() + 1, -1);
+    int  depth     = base;
+    int  max_depth = base;
+    bool reachable = true;
+
+    for (std::size_t offset = 0; offset < code_.size();
+         offset += InstructionSize(offset)) {
+        if (target_depth[offset] >= 0) {
+            depth     = reachable ? std::max(depth, target_depth[offset])
+                                  : target_depth[offset];
+            reachable = true;
+        }
+        if (!reachable)
+            continue;
+
+        uint8_t instruction = code_[offset];
+        switch (instruction) {
+            case OpCode::kOpConstant:
+            case OpCode::kOpConstantLong:
+            case OpCode::kOpNil:
+            case OpCode::kOpTrue:
+            case OpCode::kOpFalse:
+            case OpCode::kOpGetGlobal:
+            case OpCode::kOpGetGlobalLong:
+            case OpCode::kOpGetLocal:
+            case OpCode::kOpGetLocalLong:
+            case OpCode::kOpGetUpvalue:
+            case OpCode::kOpClosure:
+            case OpCode::kOpClosureLong:
+            case OpCode::kOpClass:
+            case OpCode::kOpClassLong:
+            case OpCode::kOpGetLocalGetProperty:
+                depth++;
+                break;
+            case OpCode::kOpGetLocalConstantAdd:
+                /* Operands that are not both numbers are pushed for
+                   kOpAdd, peaking one slot above the result. */
+                max_depth = std::max(max_depth, depth + 2);
+                depth++;
+                break;
+            case OpCode::kOpGetLocalGetLocal:
+                depth += 2;
+                break;
+            case OpCode::KOpEqual:
+            case OpCode::kOpNotEqual:
+            case OpCode::kOpGreater:
+            case OpCode::kOpGreaterEqual:
+            case OpCode::kOpLess:
+            case OpCode::kOpLessEqual:
+            case OpCode::kOpAdd:
+            case OpCode::kOpSubtract:
+            case OpCode::kOpMultiply:
+            case OpCode::kOpDivide:
+            case OpCode::kOpPrint:
+            case OpCode::kOpPop:
+            case OpCode::kOpDefineGlobal:
+            case OpCode::kOpDefineGlobalLong:
+            case OpCode::kOpCloseUpvalue:
+            case OpCode::kOpSetProperty:
+            case OpCode::kOpSetPropertyLong:
+            case OpCode::kOpMethod:
+            case OpCode::kOpMethodLong:
+            case OpCode::kOpInherit:
+            case OpCode::kOpGetSuper:
+            case OpCode::kOpGetSuperLong:
+                depth--;
+                break;
+            case OpCode::kOpCall:
+                depth -= code_[offset + 1];
+                break;
+            case OpCode::kOpInvoke:
+                depth -= code_[offset + 2];
+                break;
+            case OpCode::kOpInvokeLong:
+                depth -= code_[offset + 4];
+                break;
+            case OpCode::kOpSuperInvoke:
+                depth -= code_[offset + 2] + 1;
+                break;
+            case OpCode::kOpSuperInvokeLong:
+                depth -= code_[offset + 4] + 1;
+                break;
+            case OpCode::kOpJumpIfFalse:
+            case OpCode::kOpJumpIfTrue:
+            case OpCode::kOpLessJumpIfFalse:
+            case OpCode::kOpJump: {
+                if (OpCode::kOpLessJumpIfFalse == instruction)
+                    depth -= 2;
+                std::size_t target = offset + 3 + ReadOperand(offset + 1, 2);
+                target_depth[target] = std::max(target_depth[target], depth);
+                reachable = (instruction != OpCode::kOpJump);
+                break;
+            }
+            case OpCode::kOpLoop:
+            case OpCode::kOpReturn:
+                reachable = false;
+                break;
+            default:
+                break;
+        }
+        max_depth = std::max(max_depth, depth);
+    }
+    return max_depth;
+}
+
+bool
+Chunk::Verify(int arity,
+              int upvalue_count,
+              std::size_t globals,
+              std::size_t caches) const
+{
+    const std::size_t size = code_.size();
+    auto is_constant = [this](uint32_t index) {
+        return index < constants_.size();
+    };
+    auto is_name = [this](uint32_t index) {
+        return (index < constants_.size()) && obj::IsString(constants_[index]);
+    };
+    auto is_cache = [caches](uint32_t index) { return index < caches; };
+
+    /* Decode every instruction first, checking its operands and recording
+       its stack effect: the number of values it pops (at least as deep as
+       the local slots it reads) and pushes. */
+    struct Effect {
+        uint32_t pops   = 0;
+        uint32_t pushes = 0;
+        uint32_t locals = 0;
+        bool     start  = false;
+    };
+    std::vector<Effect> effects(size);
+    for (std::size_t offset = 0; offset < size;) {
+        uint8_t instruction = code_[offset];
+        if (instruction > OpCode::kOpLessJumpIfFalse)
+            return false;
+
+        /* Closures are sized by the function they create, check it before
+           calling InstructionSize(). */
+        if ((OpCode::kOpClosure == instruction) ||
+            (OpCode::kOpClosureLong == instruction)) {
+            int width = (OpCode::kOpClosure == instruction) ? 1 : 3;
+            if (offset + 1 + width > size)
+                return false;
+            uint32_t index = ReadOperand(offset + 1, width);
+            if (!is_constant(index) || !obj::IsFunction(constants_[index]))
+                return false;
+        }
+        std::size_t length = InstructionSize(offset);
+        if (offset + length > size)
+            return false;
+
+        bool     valid  = true;
+        uint32_t pops   = 0;
+        uint32_t pushes = 0;
+        uint32_t locals = 0;
+        switch (instruction) {
+            case OpCode::kOpConstant:
+                valid  = is_constant(code_[offset + 1]);
+                pushes = 1;
+                break;
+            case OpCode::kOpConstantLong:
+                valid  = is_constant(ReadOperand(offset + 1, 3));
+                pushes = 1;
+                break;
+            case OpCode::kOpNil:
+            case OpCode::kOpTrue:
+            case OpCode::kOpFalse:
+                pushes = 1;
+                break;
+            case OpCode::kOpReturn:
+            case OpCode::kOpPrint:
+            case OpCode::kOpPop:
+            case OpCode::kOpCloseUpvalue:
+                pops = 1;
+                break;
+            case OpCode::kOpNot:
+            case OpCode::kOpNegate:
+                pops   = 1;
+                pushes = 1;
+                break;
+            case OpCode::KOpEqual:
+            case OpCode::kOpNotEqual:
+            case OpCode::kOpGreater:
+            case OpCode::kOpGreaterEqual:
+            case OpCode::kOpLess:
+            case OpCode::kOpLessEqual:
+            case OpCode::kOpAdd:
+            case OpCode::kOpSubtract:
+            case OpCode::kOpMultiply:
+            case OpCode::kOpDivide:
+            case OpCode::kOpInherit:
+                pops   = 2;
+                pushes = 1;
+                break;
+            case OpCode::kOpDefineGlobal:
+            case OpCode::kOpGetGlobal:
+            case OpCode::kOpSetGlobal:
+            case OpCode::kOpDefineGlobalLong:
+            case OpCode::kOpGetGlobalLong:
+            case OpCode::kOpSetGlobalLong: {
+                bool is_long = (instruction >= OpCode::kOpDefineGlobalLong);
+                valid  = (ReadOperand(offset + 1, is_long ? 3 : 2) < globals);
+                pops   = ((OpCode::kOpGetGlobal == instruction) ||
+                          (OpCode::kOpGetGlobalLong == instruction)) ? 0 : 1;
+                pushes = ((OpCode::kOpDefineGlobal == instruction) ||
+                          (OpCode::kOpDefineGlobalLong == instruction)) ? 0 : 1;
+                break;
+            }
+            case OpCode::kOpGetLocal:
+            case OpCode::kOpSetLocal:
+            case OpCode::kOpGetLocalLong:
+            case OpCode::kOpSetLocalLong: {
+                bool is_long = (instruction >= OpCode::kOpGetLocalLong);
+                locals = ReadOperand(offset + 1, is_long ? 3 : 1) + 1;
+                pops   = ((OpCode::kOpSetLocal == instruction) ||
+                          (OpCode::kOpSetLocalLong == instruction)) ? 1 : 0;
+                pushes = 1;
+                break;
+            }
+            case OpCode::kOpGetUpvalue:
+            case OpCode::kOpSetUpvalue:
+                valid  = (code_[offset + 1] < upvalue_count);
+                pops   = (OpCode::kOpSetUpvalue == instruction) ? 1 : 0;
+                pushes = 1;
+                break;
+            case OpCode::kOpJumpIfFalse:
+            case OpCode::kOpJumpIfTrue:
+            case OpCode::kOpLessJumpIfFalse:
+            case OpCode::kOpJump:
+                pops   = (OpCode::kOpJump == instruction) ? 0 :
+                         (OpCode::kOpLessJumpIfFalse == instruction) ? 2 : 1;
+                pushes = (OpCode::kOpLessJumpIfFalse == instruction) ? 0 : pops;
+                break;
+            case OpCode::kOpLoop:
+                valid = (ReadOperand(offset + 1, 2) <= offset + 3);
+                break;
+            case OpCode::kOpCall:
+                pops   = code_[offset + 1] + 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpClosure:
+            case OpCode::kOpClosureLong: {
+                int width = (OpCode::kOpClosure == instruction) ? 1 : 3;
+                const obj::ObjFunction* function =
+                    obj::AsFunction(constants_[ReadOperand(offset + 1, width)]);
+                for (int i = 0; valid && (i < function->upvalue_count); ++i) {
+                    std::size_t upvalue = offset + 1 + width + 4 * i;
+                    uint32_t index = ReadOperand(upvalue + 1, 3);
+                    /* A function declared as a local captures the slot
+                       its closure is about to be pushed to. */
+                    if (1 == code_[upvalue])
+                        locals = std::max(locals, index);
+                    else
+                        valid = (0 == code_[upvalue]) &&
+                                (index < static_cast<uint32_t>(upvalue_count));
+                }
+                pushes = 1;
+                break;
+            }
+            case OpCode::kOpClass:
+                valid  = is_name(code_[offset + 1]);
+                pushes = 1;
+                break;
+            case OpCode::kOpClassLong:
+                valid  = is_name(ReadOperand(offset + 1, 3));
+                pushes = 1;
+                break;
+            case OpCode::kOpMethod:
+            case OpCode::kOpGetSuper:
+                valid  = is_name(code_[offset + 1]);
+                pops   = 2;
+                pushes = 1;
+                break;
+            case OpCode::kOpMethodLong:
+            case OpCode::kOpGetSuperLong:
+                valid  = is_name(ReadOperand(offset + 1, 3));
+                pops   = 2;
+                pushes = 1;
+                break;
+            case OpCode::kOpGetProperty:
+            case OpCode::kOpSetProperty:
+            case OpCode::kOpGetMethod:
+                valid  = is_name(code_[offset + 1]) &&
+                         is_cache(ReadOperand(offset + 2, 2));
+                pops   = (OpCode::kOpSetProperty == instruction) ? 2 : 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpGetPropertyLong:
+            case OpCode::kOpSetPropertyLong:
+            case OpCode::kOpGetMethodLong:
+                valid  = is_name(ReadOperand(offset + 1, 3)) &&
+                         is_cache(ReadOperand(offset + 4, 2));
+                pops   = (OpCode::kOpSetPropertyLong == instruction) ? 2 : 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpInvoke:
+                valid  = is_name(code_[offset + 1]) &&
+                         is_cache(ReadOperand(offset + 3, 2));
+                pops   = code_[offset + 2] + 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpInvokeLong:
+                valid  = is_name(ReadOperand(offset + 1, 3)) &&
+                         is_cache(ReadOperand(offset + 5, 2));
+                pops   = code_[offset + 4] + 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpSuperInvoke:
+                valid  = is_name(code_[offset + 1]);
+                pops   = code_[offset + 2] + 2;
+                pushes = 1;
+                break;
+            case OpCode::kOpSuperInvokeLong:
+                valid  = is_name(ReadOperand(offset + 1, 3));
+                pops   = code_[offset + 4] + 2;
+                pushes = 1;
+                break;
+            case OpCode::kOpGetLocalGetLocal:
+                locals = std::max(code_[offset + 1], code_[offset + 2]) + 1;
+                pushes = 2;
+                break;
+            case OpCode::kOpGetLocalConstantAdd:
+                valid  = is_constant(code_[offset + 2]);
+                locals = code_[offset + 1] + 1;
+                pushes = 1;
+                break;
+            case OpCode::kOpGetLocalGetProperty:
+                valid  = is_name(code_[offset + 2]) &&
+                         is_cache(ReadOperand(offset + 3, 2));
+                locals = code_[offset + 1] + 1;
+                pushes = 1;
+                break;
+            default:
+                break;
+        }
+        if (!valid)
+            return false;
+        effects[offset] = {pops, pushes, locals, true};
+        offset += length;
+    }
+
+    /* Then follow every path from the entry. The stack depth, counted from
+       the callee's slot, must be the same on all paths reaching an
+       instruction, and no path may run past the end of the code. */
+    std::vector<int>         depth_at(size, -1);
+    std::vector<std::size_t> pending;
+    auto reach = [&](std::size_t target, int depth) {
+        if ((target >= size) || !effects[target].start)
+            return false;
+        if (depth_at[target] < 0) {
+            depth_at[target] = depth;
+            pending.push_back(target);
+        }
+        return (depth_at[target] == depth);
+    };
+    if ((0 == size) || !reach(0, arity + 1))
+        return false;
+    while (!pending.empty()) {
+        std::size_t   offset = pending.back();
+        const Effect& effect = effects[offset];
+        int           depth  = depth_at[offset];
+        pending.pop_back();
+        if ((static_cast<uint32_t>(depth) < effect.pops) ||
+            (static_cast<uint32_t>(depth) < effect.locals))
+            return false;
+        depth += static_cast<int>(effect.pushes) - static_cast<int>(effect.pops);
+
+        uint8_t instruction = code_[offset];
+        switch (instruction) {
+            case OpCode::kOpJumpIfFalse:
+            case OpCode::kOpJumpIfTrue:
+            case OpCode::kOpLessJumpIfFalse:
+            case OpCode::kOpJump:
+                if (!reach(offset + 3 + ReadOperand(offset + 1, 2), depth))
+                    return false;
+                break;
+            case OpCode::kOpLoop:
+                if (!reach(offset + 3 - ReadOperand(offset + 1, 2), depth))
+                    return false;
+                break;
+            default:
+                break;
+        }
+        if ((OpCode::kOpJump != instruction) &&
+            (OpCode::kOpLoop != instruction) &&
+            (OpCode::kOpReturn != instruction) &&
+            !reach(offset + InstructionSize(offset), depth))
+            return false;
+    }
+    return true;
+}
+
 void
 Chunk::Disassemble(const std::string& name) const
 {
@@ -0,0 +1,340 @@
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+
+#include "Value.h"
+#include "Chunk.h"
+
+namespace lox
+{
+namespace
+{
+constexpr int kMaxJumpHops = 8; /*!< Longest jump chain followed when threading. */
+
+/*!
+ * \struct Instruction
+ * \brief The Instruction struct describes one decoded instruction while
+ *        Chunk::Optimize() rewrites the code.
+ */
+struct Instruction
+{
+    int     offset;            /*!< Offset in the original code. */
+    int     size;              /*!< Size in bytes, operands included. */
+    int     line;              /*!< Source line. */
+    uint8_t op;                /*!< Opcode, possibly rewritten. */
+    int     target    = -1;    /*!< Jumps: index of the destination instruction. */
+    int     constant  = -1;    /*!< Constants: replacement constant index, or -1. */
+    int     fused     = 0;     /*!< Superinstructions: number of instructions absorbed. */
+    bool    removed   = false; /*!< Set if the instruction is dropped. */
+    bool    is_target = false; /*!< Set if a jump lands on the instruction. */
+}; // end Instruction
+
+bool
+IsJump(uint8_t op)
+{
+    return ((Chunk::OpCode::kOpJump == op) ||
+            (Chunk::OpCode::kOpJumpIfFalse == op) ||
+            (Chunk::OpCode::kOpJumpIfTrue == op) ||
+            (Chunk::OpCode::kOpLessJumpIfFalse == op) ||
+            (Chunk::OpCode::kOpLoop == op));
+}
+
+/*!
+ * \brief Return \c true if \a op pushes a value without any other effect.
+ */
+bool
+IsPurePush(uint8_t op)
+{
+    switch (op) {
+        case Chunk::OpCode::kOpConstant:
+        case Chunk::OpCode::kOpConstantLong:
+        case Chunk::OpCode::kOpNil:
+        case Chunk::OpCode::kOpTrue:
+        case Chunk::OpCode::kOpFalse:
+        case Chunk::OpCode::kOpGetLocal:
+        case Chunk::OpCode::kOpGetLocalLong:
+        case Chunk::OpCode::kOpGetUpvalue:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/*!
+ * \brief Return \c true if the \a n instructions of \a code following
+ *        index \a i exist and can be absorbed into a superinstruction (i.e.,
+ *        are live and not jump destinations).
+ */
+bool
+CanAbsorb(const std::vector<Instruction>& code, int i, int n)
+{
+    if (i + n >= static_cast<int>(code.size()))
+        return false;
+    for (int j = i + 1; j <= i + n; ++j) {
+        if (code[j].removed || code[j].is_target)
+            return false;
+    }
+    return true;
+}
+
+/*!
+ * \brief Fuse the common instruction sequences of \a code into
+ *        superinstructions (see Chunk::OpCode).
+ *
+ * The first instruction of a sequence takes the superinstruction opcode and
+ * records the number of instructions it absorbs, the absorbed instructions
+ * are marked removed. Sequences never span a jump destination.
+ */
+void
+FuseSuperInstructions(std::vector<Instruction>& code)
+{
+    int count = static_cast<int>(code.size());
+    for (int i = 0; i < count; ++i) {
+        Instruction& first = code[i];
+        if (first.removed)
+            continue;
+
+        if (Chunk::OpCode::kOpGetLocal == first.op) {
+            if (CanAbsorb(code, i, 2) &&
+                (Chunk::OpCode::kOpConstant == code[i + 1].op) &&
+                (code[i + 1].constant < 0) &&
+                (Chunk::OpCode::kOpAdd == code[i + 2].op)) {
+                first.op    = Chunk::OpCode::kOpGetLocalConstantAdd;
+                first.fused = 2;
+            } else if (CanAbsorb(code, i, 1) &&
+                       (Chunk::OpCode::kOpGetProperty == code[i + 1].op)) {
+                first.op    = Chunk::OpCode::kOpGetLocalGetProperty;
+                first.fused = 1;
+            } else if (CanAbsorb(code, i, 1) &&
+                       (Chunk::OpCode::kOpGetLocal == code[i + 1].op)) {
+                first.op    = Chunk::OpCode::kOpGetLocalGetLocal;
+                first.fused = 1;
+            }
+        } else if ((Chunk::OpCode::kOpLess == first.op) &&
+                   CanAbsorb(code, i, 2) &&
+                   (Chunk::OpCode::kOpJumpIfFalse == code[i + 1].op) &&
+                   (Chunk::OpCode::kOpPop == code[i + 2].op)) {
+            /* The condition is popped on both paths: the fused jump pops it
+               itself and lands past the Pop of the jump destination. */
+            int target = code[i + 1].target;
+            if ((target >= count) || code[target].removed ||
+                (Chunk::OpCode::kOpPop != code[target].op))
+                continue;
+            first.op     = Chunk::OpCode::kOpLessJumpIfFalse;
+            first.target = target + 1;
+            first.fused  = 1;
+            code[i + 2].removed = true;
+        }
+
+        for (int j = 1; j <= first.fused; ++j) {
+            code[i + j].removed = true;
+            first.size += code[i + j].size - 1;
+        }
+        i += first.fused;
+    }
+}
+
+/*!
+ * \brief Retarget the jumps of \a code that land on another jump to the
+ *        final destination of the chain.
+ *
+ * An unconditional jump may follow a kOpJump or a kOpLoop. A conditional
+ * jump may follow a kOpJump, or a conditional jump of the same kind since
+ * the latter tests the very value that was just tested. Conditional jumps
+ * only go forward. Offsets are checked against the original code, removing
+ * instructions later only shortens jumps.
+ */
+void
+ThreadJumps(std::vector<Instruction>& code, int code_size)
+{
+    int count = static_cast<int>(code.size());
+    for (int i = 0; i < count; ++i) {
+        Instruction& jump = code[i];
+        if (!IsJump(jump.op) || (Chunk::OpCode::kOpLoop == jump.op))
+            continue;
+
+        int target = jump.target;
+        for (int hops = 0; (hops < kMaxJumpHops) && (target < count); ++hops) {
+            const Instruction& next = code[target];
+            bool follow =
+                (Chunk::OpCode::kOpJump == next.op) ||
+                ((Chunk::OpCode::kOpLoop == next.op) &&
+                 (Chunk::OpCode::kOpJump == jump.op)) ||
+                ((next.op == jump.op) && (Chunk::OpCode::kOpJump != jump.op));
+            if (!follow || (next.target == target) || (next.target == i))
+                break;
+            if ((Chunk::OpCode::kOpJump != jump.op) && (next.target < i))
+                break;
+
+            int dest = (next.target < count) ? code[next.target].offset
+                                             : code_size;
+            if (std::abs(dest - (jump.offset + 3)) > UINT16_MAX)
+                break;
+            target = next.target;
+        }
+        jump.target = target;
+    }
+}
+} // end anonymous namespace
+
+std::size_t
+Chunk::Optimize()
+{
+    /* Decode the code into a list of instructions, jump destinations are
+       tracked as instruction indices so they survive the rewrites. */
+    std::vector<Instruction> code;
+    std::vector<int> index(code_.size() + 1, -1);
+    code.reserve(code_.size() / 2);
+    std::size_t run = 0;
+    for (std::size_t offset = 0; offset < code_.size();) {
+        while ((run + 1 < lines_.size()) &&
+               (lines_[run + 1].start <= static_cast<int>(offset)))
+            run++;
+
+        Instruction instruction = {};
+        instruction.offset = static_cast<int>(offset);
+        instruction.size   = static_cast<int>(InstructionSize(offset));
+        instruction.line   = lines_[run].line;
+        instruction.op     = code_[offset];
+
+        index[offset] = static_cast<int>(code.size());
+        code.push_back(instruction);
+        offset += instruction.size;
+    }
+    int count = static_cast<int>(code.size());
+    index[code_.size()] = count;
+
+    for (Instruction& instruction : code) {
+        if (!IsJump(instruction.op))
+            continue;
+        int jump   = ReadOperand(instruction.offset + 1, 2);
+        int target = instruction.offset + 3 +
+            ((Chunk::OpCode::kOpLoop == instruction.op) ? -jump : jump);
+        instruction.target = index[target];
+    }
+
+    ThreadJumps(code, static_cast<int>(code_.size()));
+    for (const Instruction& instruction : code) {
+        if (IsJump(instruction.op) && (instruction.target < count))
+            code[instruction.target].is_target = true;
+    }
+
+    /* Rewrite instruction pairs. The second instruction of a pair is
+       removed or changed so it must not be a jump destination. */
+    for (int i = 0; i + 1 < count; ++i) {
+        Instruction& first  = code[i];
+        Instruction& second = code[i + 1];
+        if (first.removed || second.is_target)
+            continue;
+
+        if (IsPurePush(first.op) && (OpCode::kOpPop == second.op)) {
+            first.removed  = true;
+            second.removed = true;
+            i++;
+        } else if ((OpCode::kOpNot == first.op) &&
+                   (OpCode::kOpJumpIfFalse == second.op) &&
+                   (i + 2 < count) && (OpCode::kOpPop == code[i + 2].op) &&
+                   (second.target < count) &&
+                   (OpCode::kOpPop == code[second.target].op)) {
+            /* The negated condition is popped on both paths, so the jump
+               can test the condition itself. */
+            first.removed = true;
+            second.op     = OpCode::kOpJumpIfTrue;
+            i++;
+        } else if (((OpCode::kOpConstant == first.op) ||
+                    (OpCode::kOpConstantLong == first.op)) &&
+                   (OpCode::kOpNegate == second.op)) {
+            int width = (OpCode::kOpConstant == first.op) ? 1 : 3;
+            val::Value value = constants_[ReadOperand(first.offset + 1, width)];
+            uint32_t limit = (1 == width) ? UINT8_MAX : kMaxLongOperand;
+            if (val::IsNumber(value) && (constants_.size() <= limit)) {
+                first.constant =
+                    AddConstant(val::NumberVal(-val::AsNumber(value)));
+                second.removed = true;
+                i++;
+            }
+        }
+    }
+
+    /* Drop forward jumps to the instruction that follows them, then map
+       every instruction to the first live instruction at or after it. */
+    std::vector<int> live(count + 1, count);
+    int next_live = count;
+    for (int i = count - 1; i >= 0; --i) {
+        Instruction& instruction = code[i];
+        if (!instruction.removed && IsJump(instruction.op) &&
+            (OpCode::kOpLoop != instruction.op) &&
+            (instruction.target > i) && (live[instruction.target] == next_live))
+            instruction.removed = true;
+        if (!instruction.removed)
+            next_live = i;
+        live[i] = next_live;
+    }
+
+    /* Fusing removes instructions, map them again. */
+    FuseSuperInstructions(code);
+    for (int i = count - 1; i >= 0; --i)
+        live[i] = code[i].removed ? live[i + 1] : i;
+
+    std::vector<int> start(count + 1, 0);
+    int size = 0;
+    for (int i = 0; i < count; ++i) {
+        start[i] = size;
+        if (!code[i].removed)
+            size += code[i].size;
+    }
+    start[count] = size;
+
+    /* Encode the surviving instructions. */
+    std::vector<uint8_t> optimized;
+    std::vector<LineRun> lines;
+    optimized.reserve(size);
+    for (int i = 0; i < count; ++i) {
+        const Instruction& instruction = code[i];
+        if (instruction.removed)
+            continue;
+
+        int at = static_cast<int>(optimized.size());
+        if (lines.empty() || (lines.back().line != instruction.line))
+            lines.push_back({at, instruction.line});
+
+        /* A superinstruction is the first instruction followed by the
+           operands of the ones it absorbed. */
+        int own_size = instruction.size;
+        for (int j = i + 1; j <= i + instruction.fused; ++j)
+            own_size -= code[j].size - 1;
+        optimized.insert(optimized.end(), code_.begin() + instruction.offset,
+                         code_.begin() + instruction.offset + own_size);
+        optimized[at] = instruction.op;
+        for (int j = i + 1; j <= i + instruction.fused; ++j) {
+            optimized.insert(optimized.end(),
+                             code_.begin() + code[j].offset + 1,
+                             code_.begin() + code[j].offset + code[j].size);
+        }
+
+        if (instruction.constant >= 0) {
+            int width = instruction.size - 1;
+            for (int byte = 0; byte < width; ++byte) {
+                optimized[at + 1 + byte] = static_cast<uint8_t>(
+                    instruction.constant >> (8 * (width - 1 - byte)));
+            }
+        }
+        if (IsJump(instruction.op)) {
+            int dest = start[live[instruction.target]];
+            int jump = dest - (at + 3);
+            if (jump < 0) {
+                /* Only kOpLoop and threaded kOpJumps go backward. */
+                optimized[at] = OpCode::kOpLoop;
+                jump = -jump;
+            }
+            optimized[at + 1] = static_cast<uint8_t>((jump >> 8) & 0xFF);
+            optimized[at + 2] = static_cast<uint8_t>(jump & 0xFF);
+        }
+    }
+
+    std::size_t removed = code_.size() - optimized.size();
+    code_.swap(optimized);
+    lines_.swap(lines);
+    return removed;
+}
+} // end lox
@@ -1,9 +1,14 @@
 #include <cstdio>
+#include <charconv>
 #include <climits>
 #include <string>
+#include <string_view>
 #include <memory>
+#include <limits>
+#include <vector>
 
 #include "Object.h"
+#include "Heap.h"
 #include "Scanner.h"
 #include "Compiler.h"
 
@@ -11,89 +16,91 @@ namespace lox
 {
 namespace cl
 {
-std::unordered_map<lox::scanr::Token::TokenType, Compiler::ParseRule>
-Compiler::rules_ =
-{
-    {TokenType::kLeftParen,
-        {&Compiler::Grouping, &Compiler::Call, Precedence::kPrecCall}},
-    {TokenType::kRightParen,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kLeftBrace,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kRightBrace,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kComma,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kDot,
-        {nullptr, &Compiler::Dot, Precedence::kPrecCall}},
-    {TokenType::kMinus,
-        {&Compiler::Unary, &Compiler::Binary, Precedence::kPrecTerm}},
-    {TokenType::kPlus,
-        {nullptr, &Compiler::Binary, Precedence::kPrecTerm}},
-    {TokenType::kSemicolon,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kSlash,
-        {nullptr, &Compiler::Binary, Precedence::kPrecFactor}},
-    {TokenType::kStar,
-        {nullptr, &Compiler::Binary, Precedence::kPrecFactor}},
-    {TokenType::kBang,
-        {&Compiler::Unary, nullptr, Precedence::kPrecNone}},
-    {TokenType::kBangEqual,
-        {nullptr, &Compiler::Binary, Precedence::kPrecEquality}},
-    {TokenType::kEqual,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kEqualEqual,
-        {nullptr, &Compiler::Binary, Precedence::kPrecEquality}},
-    {TokenType::kGreater,
-        {nullptr, &Compiler::Binary, Precedence::kPrecComparison}},
-    {TokenType::kGreaterEqual,
-        {nullptr, &Compiler::Binary, Precedence::kPrecComparison}},
-    {TokenType::kLess,
-        {nullptr, &Compiler::Binary, Precedence::kPrecComparison}},
-    {TokenType::kLessEqual,
-        {nullptr, &Compiler::Binary, Precedence::kPrecComparison}},
-    {TokenType::kIdentifier,
-        {&Compiler::Variable, nullptr, Precedence::kPrecNone}},
-    {TokenType::kString,
-        {&Compiler::String, nullptr, Precedence::kPrecNone}},
-    {TokenType::kNumber,
-        {&Compiler::Number, nullptr,  Precedence::kPrecNone}},
-    {TokenType::kAnd,
-        {nullptr, &Compiler::And, Precedence::kPrecAnd}},
-    {TokenType::kClass,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kElse,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kFalse,
-        {&Compiler::Literal, nullptr, Precedence::kPrecNone}},
-    {TokenType::kFun,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kFor,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kIf,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kNil,
-        {&Compiler::Literal, nullptr, Precedence::kPrecNone}},
-    {TokenType::kOr,
-        {nullptr, &Compiler::Or, Precedence::kPrecOr}},
-    {TokenType::kPrint,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kReturn,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kSuper,
-        {&Compiler::Super, nullptr, Precedence::kPrecNone}},
-    {TokenType::kThis,
-        {&Compiler::This, nullptr, Precedence::kPrecNone}},
-    {TokenType::kTrue,
-        {&Compiler::Literal, nullptr, Precedence::kPrecNone}},
-    {TokenType::kVar,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kWhile,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kError,
-        {nullptr, nullptr, Precedence::kPrecNone}},
-    {TokenType::kEof,
-        {nullptr, nullptr, Precedence::kPrecNone}}
+/* Indexed by Token::TokenType, the entries must follow the declaration
+   order of the enum. */
+constexpr Compiler::ParseRule
+Compiler::rules_[] =
+{
+    /* kLeftParen */
+        {&Compiler::Grouping, &Compiler::Call, Precedence::kPrecCall},
+    /* kRightParen */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kLeftBrace */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kRightBrace */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kComma */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kDot */
+        {nullptr, &Compiler::Dot, Precedence::kPrecCall},
+    /* kMinus */
+        {&Compiler::Unary, &Compiler::Binary, Precedence::kPrecTerm},
+    /* kPlus */
+        {nullptr, &Compiler::Binary, Precedence::kPrecTerm},
+    /* kSemicolon */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kSlash */
+        {nullptr, &Compiler::Binary, Precedence::kPrecFactor},
+    /* kStar */
+        {nullptr, &Compiler::Binary, Precedence::kPrecFactor},
+    /* kBang */
+        {&Compiler::Unary, nullptr, Precedence::kPrecNone},
+    /* kBangEqual */
+        {nullptr, &Compiler::Binary, Precedence::kPrecEquality},
+    /* kEqual */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kEqualEqual */
+        {nullptr, &Compiler::Binary, Precedence::kPrecEquality},
+    /* kGreater */
+        {nullptr, &Compiler::Binary, Precedence::kPrecComparison},
+    /* kGreaterEqual */
+        {nullptr, &Compiler::Binary, Precedence::kPrecComparison},
+    /* kLess */
+        {nullptr, &Compiler::Binary, Precedence::kPrecComparison},
+    /* kLessEqual */
+        {nullptr, &Compiler::Binary, Precedence::kPrecComparison},
+    /* kIdentifier */
+        {&Compiler::Variable, nullptr, Precedence::kPrecNone},
+    /* kString */
+        {&Compiler::String, nullptr, Precedence::kPrecNone},
+    /* kNumber */
+        {&Compiler::Number, nullptr, Precedence::kPrecNone},
+    /* kAnd */
+        {nullptr, &Compiler::And, Precedence::kPrecAnd},
+    /* kClass */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kElse */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kFalse */
+        {&Compiler::Literal, nullptr, Precedence::kPrecNone},
+    /* kFun */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kFor */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kIf */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kNil */
+        {&Compiler::Literal, nullptr, Precedence::kPrecNone},
+    /* kOr */
+        {nullptr, &Compiler::Or, Precedence::kPrecOr},
+    /* kPrint */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kReturn */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kSuper */
+        {&Compiler::Super, nullptr, Precedence::kPrecNone},
+    /* kThis */
+        {&Compiler::This, nullptr, Precedence::kPrecNone},
+    /* kTrue */
+        {&Compiler::Literal, nullptr, Precedence::kPrecNone},
+    /* kVar */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kWhile */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kError */
+        {nullptr, nullptr, Precedence::kPrecNone},
+    /* kEof */
+        {nullptr, nullptr, Precedence::kPrecNone}
 };
 
 void
@@ -103,13 +110,17 @@ Compiler::InitCompiler(CompilerDataPtr enclosing,
 {
     current_ = compiler;
     current_->enclosing = enclosing;
-    current_->function  = obj::NewFunction();
+    /* Clear the function before allocating so that a GC triggered by
+       NewFunction() does not trace a stale pointer. */
+    current_->function  = nullptr;
+    current_->function  = obj::NewFunction(*heap_);
     current_->type      = type;
 
     if (type != FunctionType::kTypeScript) {
         current_->function->name =
-            obj::CopyString(parser_.previous.GetLexeme(), interned_strs_);
+            obj::CopyString(*heap_, parser_.previous.GetLexeme());
     }
+    current_->locals.resize(1);
     current_->locals[0].depth       = 0;
     current_->locals[0].is_captured = false;
 
@@ -120,32 +131,46 @@ Compiler::InitCompiler(CompilerDataPtr enclosing,
     current_->scope_depth = 0;
 }
 
+const Compiler::ParseRule&
+Compiler::GetRule(TokenType type)
+{
+    static_assert(sizeof(rules_) / sizeof(rules_[0]) ==
+                  static_cast<std::size_t>(TokenType::kEof) + 1,
+                  "Parse table is out of sync with Token::TokenType.");
+    return rules_[static_cast<std::size_t>(type)];
+}
+
 void
 Compiler::ParsePrecedence(Precedence precedence)
 {
     Advance();
 
-    ParseFn prefix_rule = rules_[parser_.previous.GetType()].prefix;
+    ParseFn prefix_rule = GetRule(parser_.previous.GetType()).prefix;
     if (!prefix_rule) {
         Error("Expect expression.");
         return;
     }
 
-    bool can_assign = precedence <= Precedence::kPrecAssignment;
-    prefix_rule(this, can_assign);
+    bool        can_assign = precedence <= Precedence::kPrecAssignment;
+    int         start      = static_cast<int>(CurrentChunk().GetCode().size());
+    std::size_t constants  = CurrentChunk().GetConstants().size();
+    (this->*prefix_rule)(can_assign);
 
-    while (precedence <= rules_[parser_.current.GetType()].precedence) {
+    while (precedence <= GetRule(parser_.current.GetType()).precedence) {
         Advance();
-        ParseFn infix_rule = rules_[parser_.previous.GetType()].infix;
-        infix_rule(this, can_assign);
+        ParseFn infix_rule = GetRule(parser_.previous.GetType()).infix;
+        /* The code emitted so far is the infix rule's left operand. */
+        operand_start_     = start;
+        operand_constants_ = constants;
+        (this->*infix_rule)(can_assign);
     }
 
     if (can_assign && Match(TokenType::kEqual))
         Error("Invalid assignment target.");
 }
 
-uint8_t
-Compiler::ParseVariable(const std::string& error_message)
+uint32_t
+Compiler::ParseVariable(std::string_view error_message)
 {
     Consume(TokenType::kIdentifier, error_message);
 
@@ -153,18 +178,19 @@ Compiler::ParseVariable(const std::string& error_message)
     if (current_->scope_depth > 0)
         return 0;
 
-    return IdentifierConstant(parser_.previous);
+    return GlobalSlot(parser_.previous);
 }
 
 void
-Compiler::DefineVariable(uint8_t global)
+Compiler::DefineVariable(uint32_t global)
 {
     if (current_->scope_depth > 0) {
         MarkInitialized();
         return;
     }
 
-    EmitBytes(Chunk::OpCode::kOpDefineGlobal, global);
+    EmitGlobal(Chunk::OpCode::kOpDefineGlobal,
+               Chunk::OpCode::kOpDefineGlobalLong, global);
 }
 
 void
@@ -343,7 +369,7 @@ Compiler::Declaration()
 void
 Compiler::VarDeclaration()
 {
-    uint8_t global = ParseVariable("Expect variable name.");
+    uint32_t global = ParseVariable("Expect variable name.");
     if (Match(TokenType::kEqual))
         Expression();
     else
@@ -358,7 +384,7 @@ Compiler::VarDeclaration()
 void
 Compiler::FunDeclaration()
 {
-    uint8_t global = ParseVariable("Expect function name.");
+    uint32_t global = ParseVariable("Expect function name.");
     MarkInitialized();
     Function(FunctionType::kTypeFunction);
     DefineVariable(global);
@@ -368,12 +394,16 @@ void
 Compiler::ClassDeclaration()
 {
     Consume(TokenType::kIdentifier, "Expect class name.");
-    Token   class_name    = parser_.previous;
-    uint8_t name_constant = IdentifierConstant(parser_.previous);
+    Token    class_name    = parser_.previous;
+    uint32_t name_constant = IdentifierConstant(parser_.previous);
+    uint32_t global        = 0;
     DeclareVariable();
+    if (0 == current_->scope_depth)
+        global = GlobalSlot(class_name);
 
-    EmitBytes(Chunk::OpCode::kOpClass, name_constant);
-    DefineVariable(name_constant);
+    EmitIndexed(Chunk::OpCode::kOpClass, Chunk::OpCode::kOpClassLong,
+                name_constant);
+    DefineVariable(global);
 
     ClassCompiler class_compiler;
     class_compiler.enclosing      = current_class_;
@@ -412,27 +442,30 @@ void
 Compiler::Method()
 {
     Consume(TokenType::kIdentifier, "Expect method name.");
-    uint8_t constant = IdentifierConstant(parser_.previous);
+    uint32_t constant = IdentifierConstant(parser_.previous);
 
     FunctionType type = FunctionType::kTypeMethod;
-    static const std::string kInitStr("init");
-    if (parser_.previous.GetLexeme() == kInitStr)
+    if (parser_.previous.GetLexeme() == "init")
         type = FunctionType::kTypeInitializer;
     Function(type);
 
-    EmitBytes(Chunk::OpCode::kOpMethod, constant);
+    EmitIndexed(Chunk::OpCode::kOpMethod, Chunk::OpCode::kOpMethodLong,
+                constant);
 }
 
 void
 Compiler::AddLocal(const Token& name)
 {
-    if (current_->local_count == (UINT8_MAX + 1)) {
+    if (current_->local_count == kMaxLocals) {
         Error("Too many local variables in function.");
         return;
     }
 
     Local local = {.name=name, .depth=-1, .is_captured=false};
-    current_->locals[current_->local_count] = local;
+    if (current_->local_count == static_cast<int>(current_->locals.size()))
+        current_->locals.push_back(local);
+    else
+        current_->locals[current_->local_count] = local;
     current_->local_count++;
 }
 
@@ -487,19 +520,19 @@ Compiler::ResolveUpvalue(CompilerDataPtr compiler, const Token& name)
     int local = ResolveLocal(compiler->enclosing, name);
     if (-1 != local) {
         compiler->enclosing->locals[local].is_captured = true;
-        return AddUpvalue(compiler, static_cast<uint8_t>(local), true);
+        return AddUpvalue(compiler, static_cast<uint32_t>(local), true);
     }
 
     int upvalue = ResolveUpvalue(compiler->enclosing, name);
     if (-1 != upvalue)
-        return AddUpvalue(compiler, static_cast<uint8_t>(upvalue), false);
+        return AddUpvalue(compiler, static_cast<uint32_t>(upvalue), false);
 
     return -1;
 }
 
 int
 Compiler::AddUpvalue(CompilerDataPtr compiler,
-                     uint8_t index,
+                     uint32_t index,
                      bool is_local)
 {
     int upvalue_count = compiler->function->upvalue_count;
@@ -561,7 +594,7 @@ Compiler::Function(FunctionType type)
             if (current_->function->arity > 255)
                 ErrorAtCurrent("Can't have more than 255 parameters.");
 
-            uint8_t constant = ParseVariable("Expect paramater name.");
+            uint32_t constant = ParseVariable("Expect paramater name.");
             DefineVariable(constant);
         } while (Match(TokenType::kComma));
     }
@@ -569,12 +602,13 @@ Compiler::Function(FunctionType type)
     Consume(TokenType::kLeftBrace, "Expect '{' before function body");
     Block();
 
-    std::shared_ptr<obj::ObjFunction> function = EndCompiler();
-    EmitBytes(Chunk::OpCode::kOpClosure, MakeConstant(obj::ObjVal(function)));
+    obj::ObjFunction* function = EndCompiler();
+    EmitIndexed(Chunk::OpCode::kOpClosure, Chunk::OpCode::kOpClosureLong,
+                MakeConstant(obj::ObjVal(function)));
 
     for (int i = 0; i < function->upvalue_count; ++i) {
         EmitByte(compiler->upvalues[i].is_local ?  1 : 0);
-        EmitByte(compiler->upvalues[i].index);
+        EmitLongOperand(compiler->upvalues[i].index);
     }
 }
 
@@ -618,11 +652,23 @@ Compiler::Match(TokenType type)
     return true;
 }
 
-uint8_t
+uint32_t
 Compiler::IdentifierConstant(const Token& name)
 {
     return MakeConstant(obj::ObjVal(
-                obj::CopyString(name.GetLexeme(), interned_strs_)));
+                obj::CopyString(*heap_, name.GetLexeme())));
+}
+
+uint32_t
+Compiler::GlobalSlot(const Token& name)
+{
+    std::size_t slot =
+        globals_->Resolve(obj::CopyString(*heap_, name.GetLexeme()));
+    if (slot >= obj::Globals::kMaxGlobals) {
+        Error("Too many global variables.");
+        return 0;
+    }
+    return static_cast<uint32_t>(slot);
 }
 
 void
@@ -630,29 +676,41 @@ Compiler::NamedVariable(const Token& name, bool can_assign)
 {
     uint8_t get_op = 0;
     uint8_t set_op = 0;
+    /* Upvalue indices always fit in a byte so they have no Long form. */
+    uint8_t get_long_op = 0;
+    uint8_t set_long_op = 0;
     int arg = ResolveLocal(current_, name);
     if (arg != -1) {
-        get_op = Chunk::OpCode::kOpGetLocal;
-        set_op = Chunk::OpCode::kOpSetLocal;
+        get_op      = Chunk::OpCode::kOpGetLocal;
+        set_op      = Chunk::OpCode::kOpSetLocal;
+        get_long_op = Chunk::OpCode::kOpGetLocalLong;
+        set_long_op = Chunk::OpCode::kOpSetLocalLong;
     } else if (-1 != (arg = ResolveUpvalue(current_, name))) {
         get_op = Chunk::OpCode::kOpGetUpvalue;
         set_op = Chunk::OpCode::kOpSetUpvalue;
     } else {
-        arg = IdentifierConstant(name);
-        get_op = Chunk::OpCode::kOpGetGlobal;
-        set_op = Chunk::OpCode::kOpSetGlobal;
+        uint32_t global = GlobalSlot(name);
+        if (can_assign && Match(TokenType::kEqual)) {
+            Expression();
+            EmitGlobal(Chunk::OpCode::kOpSetGlobal,
+                       Chunk::OpCode::kOpSetGlobalLong, global);
+        } else {
+            EmitGlobal(Chunk::OpCode::kOpGetGlobal,
+                       Chunk::OpCode::kOpGetGlobalLong, global);
+        }
+        return;
     }
 
     if (can_assign && Match(TokenType::kEqual)) {
         Expression();
-        EmitBytes(set_op, arg);
+        EmitIndexed(set_op, set_long_op, static_cast<uint32_t>(arg));
     } else {
-        EmitBytes(get_op, arg);
+        EmitIndexed(get_op, get_long_op, static_cast<uint32_t>(arg));
     }
 }
 
 void
-Compiler::Consume(TokenType type, const std::string& message)
+Compiler::Consume(TokenType type, std::string_view message)
 {
     if (parser_.current.GetType() == type) {
         Advance();
@@ -661,19 +719,29 @@ Compiler::Consume(TokenType type, const std::string& message)
     ErrorAtCurrent(message);
 }
 
-uint8_t
+uint32_t
 Compiler::MakeConstant(const val::Value& value)
 {
+    val::Value index;
+    bool is_string = obj::IsString(value);
+    if (is_string && current_->strings.Get(obj::AsString(value), &index))
+        return static_cast<uint32_t>(val::AsNumber(index));
+
     int constant = CurrentChunk().AddConstant(value);
-    if (constant > UINT8_MAX) {
+    if (static_cast<uint32_t>(constant) > Chunk::kMaxLongOperand) {
         Error("Too many constants in one chunk.");
         return 0;
     }
-    return static_cast<uint8_t>(constant);
+
+    if (is_string) {
+        current_->strings.Set(obj::AsString(value),
+                              val::NumberVal(static_cast<double>(constant)));
+    }
+    return static_cast<uint32_t>(constant);
 }
 
 void
-Compiler::ErrorAt(const Token& error, const std::string& message)
+Compiler::ErrorAt(const Token& error, std::string_view message)
 {
     if (parser_.panic_mode)
         return;
@@ -687,9 +755,12 @@ Compiler::ErrorAt(const Token& error, const std::string& message)
     } else if (error.GetType() == TokenType::kError) {
         /* Do nothing. */
     } else {
-        fprintf(stderr, " at %s", error.GetLexeme().c_str());
+        std::string_view lexeme = error.GetLexeme();
+        fprintf(stderr, " at %.*s", static_cast<int>(lexeme.size()),
+                lexeme.data());
     }
-    fprintf(stderr, ": %s\n", message.c_str());
+    fprintf(stderr, ": %.*s\n", static_cast<int>(message.size()),
+            message.data());
 
     parser_.had_error = true;
 }
@@ -727,6 +798,62 @@ Compiler::EmitBytes(uint8_t byte1, uint8_t byte2)
     EmitByte(byte2);
 }
 
+void
+Compiler::EmitShortOperand(uint8_t instruction, uint16_t operand)
+{
+    EmitByte(instruction);
+    EmitByte((operand >> 8) & 0xFF);
+    EmitByte(operand & 0xFF);
+}
+
+void
+Compiler::EmitLongOperand(uint32_t operand)
+{
+    EmitByte((operand >> 16) & 0xFF);
+    EmitByte((operand >> 8) & 0xFF);
+    EmitByte(operand & 0xFF);
+}
+
+void
+Compiler::EmitIndexed(
+    uint8_t instruction,
+    uint8_t long_instruction,
+    uint32_t index)
+{
+    if (index <= UINT8_MAX) {
+        EmitBytes(instruction, static_cast<uint8_t>(index));
+    } else {
+        EmitByte(long_instruction);
+        EmitLongOperand(index);
+    }
+}
+
+void
+Compiler::EmitGlobal(
+    uint8_t instruction,
+    uint8_t long_instruction,
+    uint32_t slot)
+{
+    if (slot <= UINT16_MAX) {
+        EmitShortOperand(instruction, static_cast<uint16_t>(slot));
+    } else {
+        EmitByte(long_instruction);
+        EmitLongOperand(slot);
+    }
+}
+
+void
+Compiler::EmitInlineCache()
+{
+    std::size_t cache = CurrentChunk().AddInlineCache();
+    if (cache >= Chunk::kMaxInlineCaches) {
+        Error("Too many property accesses in one chunk.");
+        cache = 0;
+    }
+    EmitByte((cache >> 8) & 0xFF);
+    EmitByte(cache & 0xFF);
+}
+
 void
 Compiler::EmitReturn()
 {
@@ -762,15 +889,22 @@ Compiler::EmitLoop(int loop_start)
     EmitByte(offset & 0xFF);
 }
 
-std::shared_ptr<obj::ObjFunction>
+obj::ObjFunction*
 Compiler::EndCompiler()
 {
     EmitReturn();
-    std::shared_ptr<obj::ObjFunction> function = current_->function;
+    obj::ObjFunction* function = current_->function;
+    /* Slot zero holds the callee, followed by the arguments. Code with
+       errors is never run so it is neither optimized nor analyzed. */
+    if (!parser_.had_error) {
+        if (optimize_)
+            CurrentChunk().Optimize();
+        function->max_slots = CurrentChunk().MaxStackSlots(function->arity + 1);
+    }
 #ifdef DEBUG_PRINT_CODE
     if (!parser_.had_error) {
         CurrentChunk().Disassemble(
-            function->name ? function->name->chars : "<script>");
+            function->name ? function->name->Chars() : "<script>");
     }
 #endif
     current_ = current_->enclosing;
@@ -780,15 +914,37 @@ Compiler::EndCompiler()
 void
 Compiler::Number([[maybe_unused]]bool can_assign)
 {
-    double value = std::stod(parser_.previous.GetLexeme());
+    /* The lexeme is not null terminated, from_chars() stops at its end.
+       Literals beyond the range of a double become infinity, like the
+       result of an overflowing arithmetic operation. */
+    std::string_view lexeme = parser_.previous.GetLexeme();
+    double value = 0.0;
+    auto result =
+        std::from_chars(lexeme.data(), lexeme.data() + lexeme.size(), value);
+    if (std::errc::result_out_of_range == result.ec)
+        value = std::numeric_limits<double>::infinity();
     EmitConstant(val::NumberVal(value));
 }
 
 void
 Compiler::Grouping([[maybe_unused]]bool can_assign)
 {
+    int start = static_cast<int>(CurrentChunk().GetCode().size());
     Expression();
     Consume(TokenType::kRightParen, "Expect ')' after expression.");
+
+    /* A parenthesized property read called right away, (obj.method)(),
+       reads the property as usual but lets the call recycle the method it
+       binds (see kOpGetMethod). A jump may skip the read, as in
+       (a or obj.method)(), the call then gets the other value. */
+    int get = 0;
+    if (Check(TokenType::kLeftParen) && PropertyGetAt(start, &get)) {
+        bool is_long = (Chunk::OpCode::kOpGetPropertyLong ==
+                        CurrentChunk().GetInstruction(get));
+        CurrentChunk().SetInstruction(get,
+            is_long ? Chunk::OpCode::kOpGetMethodLong
+                    : Chunk::OpCode::kOpGetMethod);
+    }
 }
 
 void
@@ -797,8 +953,25 @@ Compiler::Unary([[maybe_unused]]bool can_assign)
     TokenType operator_type = parser_.previous.GetType();
 
     /* Compile the operand. */
+    int         start     = static_cast<int>(CurrentChunk().GetCode().size());
+    std::size_t constants = CurrentChunk().GetConstants().size();
     ParsePrecedence(Precedence::kPrecUnary);
 
+    val::Value operand;
+    if (optimize_ && LiteralAt(start, &operand)) {
+        if (TokenType::kBang == operator_type) {
+            bool falsey = val::IsNil(operand) ||
+                (val::IsBool(operand) && !val::AsBool(operand));
+            ReplaceLiterals(start, constants, val::BoolVal(falsey));
+            return;
+        }
+        if (val::IsNumber(operand)) {
+            ReplaceLiterals(start, constants,
+                            val::NumberVal(-val::AsNumber(operand)));
+            return;
+        }
+    }
+
     /* Emit the operator instruction. */
     switch (operator_type) {
         case TokenType::kBang:
@@ -817,12 +990,26 @@ void
 Compiler::Binary([[maybe_unused]]bool can_assign)
 {
     TokenType operator_type = parser_.previous.GetType();
+    int         left_start     = operand_start_;
+    std::size_t left_constants = operand_constants_;
+    int         right_start    = static_cast<int>(CurrentChunk().GetCode().size());
+    val::Value left;
+    bool left_literal = optimize_ && LiteralAt(left_start, &left);
+
     ParsePrecedence(
-        static_cast<Precedence>(rules_[operator_type].precedence + 1));
+        static_cast<Precedence>(GetRule(operator_type).precedence + 1));
+
+    val::Value right;
+    val::Value result;
+    if (left_literal && LiteralAt(right_start, &right) &&
+        FoldBinary(operator_type, left, right, &result)) {
+        ReplaceLiterals(left_start, left_constants, result);
+        return;
+    }
 
     switch (operator_type) {
         case TokenType::kBangEqual:
-            EmitBytes(Chunk::OpCode::KOpEqual, Chunk::OpCode::kOpNot);
+            EmitByte(Chunk::OpCode::kOpNotEqual);
             break;
         case TokenType::kEqualEqual:
             EmitByte(Chunk::OpCode::KOpEqual);
@@ -831,13 +1018,13 @@ Compiler::Binary([[maybe_unused]]bool can_assign)
             EmitByte(Chunk::OpCode::kOpGreater);
             break;
         case TokenType::kGreaterEqual:
-            EmitBytes(Chunk::OpCode::kOpLess, Chunk::OpCode::kOpNot);
+            EmitByte(Chunk::OpCode::kOpGreaterEqual);
             break;
         case TokenType::kLess:
             EmitByte(Chunk::OpCode::kOpLess);
             break;
         case TokenType::kLessEqual:
-            EmitBytes(Chunk::OpCode::kOpGreater, Chunk::OpCode::kOpNot);
+            EmitByte(Chunk::OpCode::kOpLessEqual);
             break;
         case TokenType::kPlus:
             EmitByte(Chunk::OpCode::kOpAdd);
@@ -857,6 +1044,145 @@ Compiler::Binary([[maybe_unused]]bool can_assign)
     }
 }
 
+bool
+Compiler::PropertyGetAt(int start, int* get)
+{
+    const Chunk& chunk = CurrentChunk();
+    std::size_t end = chunk.GetCode().size();
+    for (int offset = start; static_cast<std::size_t>(offset) < end;
+         offset += chunk.InstructionSize(offset)) {
+        uint8_t instruction = chunk.GetInstruction(offset);
+        if (((Chunk::OpCode::kOpGetProperty == instruction) ||
+             (Chunk::OpCode::kOpGetPropertyLong == instruction)) &&
+            (offset + chunk.InstructionSize(offset) == end)) {
+            *get = offset;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool
+Compiler::LiteralAt(int start, val::Value* value)
+{
+    const Chunk& chunk = CurrentChunk();
+    int size = static_cast<int>(chunk.GetCode().size()) - start;
+    if (size <= 0)
+        return false;
+
+    switch (chunk.GetInstruction(start)) {
+        case Chunk::OpCode::kOpNil:
+            *value = val::NilVal();
+            return (1 == size);
+        case Chunk::OpCode::kOpTrue:
+            *value = val::BoolVal(true);
+            return (1 == size);
+        case Chunk::OpCode::kOpFalse:
+            *value = val::BoolVal(false);
+            return (1 == size);
+        case Chunk::OpCode::kOpConstant:
+            if (2 != size)
+                return false;
+            *value = chunk.GetConstants()[chunk.GetInstruction(start + 1)];
+            return true;
+        case Chunk::OpCode::kOpConstantLong:
+            if (4 != size)
+                return false;
+            *value = chunk.GetConstants()[
+                (chunk.GetInstruction(start + 1) << 16) |
+                (chunk.GetInstruction(start + 2) << 8) |
+                chunk.GetInstruction(start + 3)];
+            return true;
+        default:
+            return false;
+    }
+}
+
+void
+Compiler::ReplaceLiterals(int start,
+                          std::size_t constants,
+                          const val::Value& value)
+{
+    Chunk& chunk = CurrentChunk();
+    chunk.Truncate(start);
+
+    /* Only the discarded loads refer to the constants added since, strings
+       included: MakeConstant() must no longer hand those out. */
+    while (chunk.GetConstants().size() > constants) {
+        const val::Value& constant = chunk.GetConstants().back();
+        if (obj::IsString(constant))
+            current_->strings.Delete(obj::AsString(constant));
+        chunk.PopConstant();
+    }
+
+    if (val::IsNil(value))
+        EmitByte(Chunk::OpCode::kOpNil);
+    else if (val::IsBool(value))
+        EmitByte(val::AsBool(value) ? Chunk::OpCode::kOpTrue
+                                    : Chunk::OpCode::kOpFalse);
+    else
+        EmitConstant(value);
+}
+
+bool
+Compiler::FoldBinary(TokenType type,
+                     const val::Value& a,
+                     const val::Value& b,
+                     val::Value* result)
+{
+    /* Equality is defined for every pair of values. */
+    if (TokenType::kEqualEqual == type) {
+        *result = val::BoolVal(val::ValuesEqual(a, b));
+        return true;
+    }
+    if (TokenType::kBangEqual == type) {
+        *result = val::BoolVal(!val::ValuesEqual(a, b));
+        return true;
+    }
+
+    if ((TokenType::kPlus == type) && obj::IsString(a) && obj::IsString(b)) {
+        *result = obj::ObjVal(obj::CopyString(
+            *heap_, obj::AsStdString(a) + obj::AsStdString(b)));
+        return true;
+    }
+
+    /* The other operators are only defined on numbers, anything else is
+       a runtime error left to the VM. */
+    if (!val::IsNumber(a) || !val::IsNumber(b))
+        return false;
+
+    double x = val::AsNumber(a);
+    double y = val::AsNumber(b);
+    switch (type) {
+        case TokenType::kGreater:
+            *result = val::BoolVal(x > y);
+            return true;
+        case TokenType::kGreaterEqual:
+            *result = val::BoolVal(x >= y);
+            return true;
+        case TokenType::kLess:
+            *result = val::BoolVal(x < y);
+            return true;
+        case TokenType::kLessEqual:
+            *result = val::BoolVal(x <= y);
+            return true;
+        case TokenType::kPlus:
+            *result = val::NumberVal(x + y);
+            return true;
+        case TokenType::kMinus:
+            *result = val::NumberVal(x - y);
+            return true;
+        case TokenType::kStar:
+            *result = val::NumberVal(x * y);
+            return true;
+        case TokenType::kSlash:
+            *result = val::NumberVal(x / y);
+            return true;
+        default:
+            return false;
+    }
+}
+
 void
 Compiler::Literal([[maybe_unused]]bool can_assign)
 {
@@ -878,11 +1204,11 @@ Compiler::Literal([[maybe_unused]]bool can_assign)
 void
 Compiler::String([[maybe_unused]]bool can_assign)
 {
-    std::string lexeme = parser_.previous.GetLexeme();
+    std::string_view lexeme = parser_.previous.GetLexeme();
 
     /* Trim off the '"' marks on either end of the lexeme before copying. */
-    std::shared_ptr<obj::Obj> str_obj =
-        obj::CopyString(lexeme.substr(1, lexeme.size() - 2), interned_strs_);
+    obj::Obj* str_obj =
+        obj::CopyString(*heap_, lexeme.substr(1, lexeme.size() - 2));
 
     EmitConstant(obj::ObjVal(str_obj));
 }
@@ -922,17 +1248,23 @@ void
 Compiler::Dot(bool can_assign)
 {
     Consume(TokenType::kIdentifier, "Expect property name after '.'.");
-    uint8_t name = IdentifierConstant(parser_.previous);
+    uint32_t name = IdentifierConstant(parser_.previous);
 
     if (can_assign && Match(TokenType::kEqual)) {
         Expression();
-        EmitBytes(Chunk::OpCode::kOpSetProperty, name);
+        EmitIndexed(Chunk::OpCode::kOpSetProperty,
+                    Chunk::OpCode::kOpSetPropertyLong, name);
+        EmitInlineCache();
     } else if (Match(TokenType::kLeftParen)) {
         uint8_t arg_count = ArgumentList();
-        EmitBytes(Chunk::OpCode::kOpInvoke, name);
+        EmitIndexed(Chunk::OpCode::kOpInvoke, Chunk::OpCode::kOpInvokeLong,
+                    name);
         EmitByte(arg_count);
+        EmitInlineCache();
     } else {
-        EmitBytes(Chunk::OpCode::kOpGetProperty, name);
+        EmitIndexed(Chunk::OpCode::kOpGetProperty,
+                    Chunk::OpCode::kOpGetPropertyLong, name);
+        EmitInlineCache();
     }
 }
 
@@ -956,43 +1288,72 @@ Compiler::Super([[maybe_unused]]bool can_assign)
 
     Consume(TokenType::kDot, "Expect '.' after 'super'.");
     Consume(TokenType::kIdentifier, "Expect superclass method name.");
-    uint8_t name = IdentifierConstant(parser_.previous);
+    uint32_t name = IdentifierConstant(parser_.previous);
 
     NamedVariable(scanr::Token(TokenType::kThis, "this", 0), false);
     if (Match(TokenType::kLeftParen)) {
         uint8_t arg_count = ArgumentList();
         NamedVariable(scanr::Token(TokenType::kSuper, "super", 0), false);
-        EmitBytes(Chunk::OpCode::kOpSuperInvoke, name);
+        EmitIndexed(Chunk::OpCode::kOpSuperInvoke,
+                    Chunk::OpCode::kOpSuperInvokeLong, name);
         EmitByte(arg_count);
     } else {
         NamedVariable(scanr::Token(TokenType::kSuper, "super", 0), false);
-        EmitBytes(Chunk::OpCode::kOpGetSuper, name);
+        EmitIndexed(Chunk::OpCode::kOpGetSuper,
+                    Chunk::OpCode::kOpGetSuperLong, name);
+    }
+}
+
+void
+Compiler::MarkCompilerRoots(obj::Heap& heap)
+{
+    for (CompilerDataPtr compiler = current_; compiler;
+         compiler = compiler->enclosing) {
+        heap.MarkObject(compiler->function);
     }
 }
 
 Compiler::Compiler() :
     scanner_(""),
-    current_(std::make_shared<CompilerData>()),
-    current_class_(nullptr)
+    heap_(nullptr),
+    globals_(nullptr),
+    current_(nullptr),
+    current_class_(nullptr),
+    optimize_(true),
+    operand_start_(0),
+    operand_constants_(0)
 {
     parser_.had_error  = false;
     parser_.panic_mode = false;
-
-    InitCompiler(nullptr, current_, FunctionType::kTypeScript);
 }
 
-std::shared_ptr<obj::ObjFunction>
-Compiler::Compile(const std::string& source,
-                  InternedStrings strings)
+obj::ObjFunction*
+Compiler::Compile(
+    std::string_view source,
+    obj::Heap& heap,
+    obj::Globals& globals,
+    bool optimize)
 {
-    scanner_       = lox::scanr::Scanner(source);
-    interned_strs_ = strings;
+    scanner_  = lox::scanr::Scanner(source);
+    heap_     = &heap;
+    globals_  = &globals;
+    optimize_ = optimize;
+
+    /* Functions under construction are only reachable from the compiler
+       stack so they must be treated as roots should a GC run mid-compile. */
+    heap_->PushRootMarker(
+        [this](obj::Heap& h) { MarkCompilerRoots(h); });
+
+    InitCompiler(nullptr, std::make_shared<CompilerData>(),
+                 FunctionType::kTypeScript);
 
     Advance();
     while (!Match(TokenType::kEof))
         Declaration();
 
-    std::shared_ptr<obj::ObjFunction> function = EndCompiler();
+    obj::ObjFunction* function = EndCompiler();
+    heap_->PopRootMarker();
+
     return (parser_.had_error ? nullptr : function);
 }
 } // end cl
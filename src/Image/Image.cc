@@ -0,0 +1,602 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <fstream>
+#include <unordered_map>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Value.h"
+#include "Object.h"
+#include "Heap.h"
+#include "Globals.h"
+#include "Chunk.h"
+#include "Image.h"
+
+namespace lox
+{
+namespace img
+{
+namespace
+{
+constexpr std::size_t kMagicSize = sizeof(kImageMagic) - 1;
+constexpr std::size_t kMinFunctionSize =
+    8 * sizeof(uint32_t); /*!< Size of a function record without code, lines or constants. */
+
+/*!
+ * \class ImageWriter
+ * \brief The ImageWriter class serializes a script and the functions and
+ *        strings it references into an in-memory image.
+ */
+class ImageWriter
+{
+public:
+    /*!
+     * \brief Return the image of \a script compiled against \a globals.
+     */
+    std::vector<uint8_t>
+    Write(const obj::ObjFunction* script, const obj::Globals& globals);
+
+private:
+    void
+    U8(uint8_t value) { bytes_.push_back(value); }
+
+    void
+    U16(uint16_t value);
+
+    void
+    U32(uint32_t value);
+
+    void
+    U64(uint64_t value);
+
+    /*!
+     * \brief Return the index of \a string in the string table, adding it
+     *        on first use.
+     */
+    uint32_t
+    StringIndex(const obj::ObjString* string);
+
+    /*!
+     * \brief Return the index of \a function in the function table, adding
+     *        it on first use.
+     */
+    uint32_t
+    FunctionIndex(const obj::ObjFunction* function);
+
+    /*!
+     * \brief Append the record of \a function to #bytes_.
+     */
+    void
+    WriteFunction(const obj::ObjFunction* function);
+
+    std::vector<uint8_t> bytes_; /*!< Image under construction. */
+
+    std::vector<const obj::ObjString*> strings_; /*!< String table. */
+    std::unordered_map<const obj::ObjString*, uint32_t>
+        string_indices_; /*!< Index of each entry of #strings_. */
+
+    std::vector<const obj::ObjFunction*> functions_; /*!< Function table. */
+    std::unordered_map<const obj::ObjFunction*, uint32_t>
+        function_indices_; /*!< Index of each entry of #functions_. */
+}; // end ImageWriter
+
+void
+ImageWriter::U16(uint16_t value)
+{
+    U8(static_cast<uint8_t>(value));
+    U8(static_cast<uint8_t>(value >> 8));
+}
+
+void
+ImageWriter::U32(uint32_t value)
+{
+    U16(static_cast<uint16_t>(value));
+    U16(static_cast<uint16_t>(value >> 16));
+}
+
+void
+ImageWriter::U64(uint64_t value)
+{
+    U32(static_cast<uint32_t>(value));
+    U32(static_cast<uint32_t>(value >> 32));
+}
+
+uint32_t
+ImageWriter::StringIndex(const obj::ObjString* string)
+{
+    /* Strings are interned so pointer equality is string equality. */
+    auto [entry, added] = string_indices_.emplace(string, strings_.size());
+    if (added)
+        strings_.push_back(string);
+    return entry->second;
+}
+
+uint32_t
+ImageWriter::FunctionIndex(const obj::ObjFunction* function)
+{
+    auto [entry, added] =
+        function_indices_.emplace(function, functions_.size());
+    if (added)
+        functions_.push_back(function);
+    return entry->second;
+}
+
+void
+ImageWriter::WriteFunction(const obj::ObjFunction* function)
+{
+    const Chunk& chunk = function->chunk;
+
+    U32(function->name ? StringIndex(function->name) : kNoName);
+    U32(static_cast<uint32_t>(function->arity));
+    U32(static_cast<uint32_t>(function->upvalue_count));
+    U32(static_cast<uint32_t>(function->max_slots));
+    U32(static_cast<uint32_t>(chunk.GetInlineCaches().size()));
+
+    const std::vector<uint8_t>& code = chunk.GetCode();
+    U32(static_cast<uint32_t>(code.size()));
+    bytes_.insert(bytes_.end(), code.begin(), code.end());
+
+    const std::vector<Chunk::LineRun>& runs = chunk.GetLineRuns();
+    U32(static_cast<uint32_t>(runs.size()));
+    for (std::size_t i = 0; i < runs.size(); ++i) {
+        int end = (i + 1 < runs.size()) ? runs[i + 1].start
+                                        : static_cast<int>(code.size());
+        U32(static_cast<uint32_t>(runs[i].line));
+        U32(static_cast<uint32_t>(end - runs[i].start));
+    }
+
+    const std::vector<val::Value>& constants = chunk.GetConstants();
+    U32(static_cast<uint32_t>(constants.size()));
+    for (const val::Value& constant : constants) {
+        if (val::IsNil(constant)) {
+            U8(ConstantTag::kTagNil);
+        } else if (val::IsBool(constant)) {
+            U8(val::AsBool(constant) ? ConstantTag::kTagTrue
+                                     : ConstantTag::kTagFalse);
+        } else if (val::IsNumber(constant)) {
+            double   number = val::AsNumber(constant);
+            uint64_t bits   = 0;
+            std::memcpy(&bits, &number, sizeof(bits));
+            U8(ConstantTag::kTagNumber);
+            U64(bits);
+        } else if (obj::IsString(constant)) {
+            U8(ConstantTag::kTagString);
+            U32(StringIndex(obj::AsString(constant)));
+        } else {
+            /* The Compiler emits no other kind of constant. */
+            U8(ConstantTag::kTagFunction);
+            U32(FunctionIndex(obj::AsFunction(constant)));
+        }
+    }
+}
+
+std::vector<uint8_t>
+ImageWriter::Write(const obj::ObjFunction* script, const obj::Globals& globals)
+{
+    /* Function records reference strings and functions that may not have
+       been met yet, so the records are serialized first and the tables
+       are emitted ahead of them once complete. */
+    FunctionIndex(script);
+    for (std::size_t i = 0; i < functions_.size(); ++i)
+        WriteFunction(functions_[i]);
+    std::vector<uint8_t> records;
+    records.swap(bytes_);
+
+    std::vector<uint32_t> global_names;
+    for (const obj::ObjString* name : globals.Names())
+        global_names.push_back(StringIndex(name));
+
+    bytes_.insert(bytes_.end(), kImageMagic, kImageMagic + kMagicSize);
+    U16(kImageVersion);
+    U16(0);
+
+    U32(static_cast<uint32_t>(strings_.size()));
+    for (const obj::ObjString* string : strings_) {
+        U32(static_cast<uint32_t>(string->length));
+        bytes_.insert(bytes_.end(), string->Chars(),
+                      string->Chars() + string->length);
+    }
+
+    U32(static_cast<uint32_t>(global_names.size()));
+    for (uint32_t name : global_names)
+        U32(name);
+
+    U32(static_cast<uint32_t>(functions_.size()));
+    bytes_.insert(bytes_.end(), records.begin(), records.end());
+
+    return std::move(bytes_);
+}
+
+/*!
+ * \class MappedFile
+ * \brief The MappedFile class maps a whole file read only in memory for
+ *        the duration of its lifetime.
+ */
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+    MappedFile(MappedFile&&) = delete;
+    MappedFile& operator=(MappedFile&&) = delete;
+
+    /*!
+     * \brief Return \c true if the file was mapped successfully.
+     */
+    bool
+    IsOpen() const { return (data_ != MAP_FAILED); }
+
+    const uint8_t*
+    Data() const { return static_cast<const uint8_t*>(data_); }
+
+    std::size_t
+    Size() const { return size_; }
+
+private:
+    void*       data_ = MAP_FAILED; /*!< Start of the mapping. */
+    std::size_t size_ = 0;          /*!< File size in bytes. */
+}; // end MappedFile
+
+MappedFile::MappedFile(const std::string& path)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+
+    struct stat info;
+    if ((0 == fstat(fd, &info)) && (info.st_size > 0)) {
+        size_ = static_cast<std::size_t>(info.st_size);
+        data_ = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    /* The mapping outlives the descriptor. */
+    close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+    if (IsOpen())
+        munmap(data_, size_);
+}
+
+/*!
+ * \class ImageReader
+ * \brief The ImageReader class decodes an image into Heap objects.
+ *
+ * Reads past the end of the image do not fail immediately: they return
+ * zeros and latch an error that Load() reports once decoding stops.
+ */
+class ImageReader
+{
+public:
+    ImageReader(const uint8_t* data,
+                std::size_t size,
+                obj::Heap& heap,
+                obj::Globals& globals) :
+        cursor_(data), end_(data + size), heap_(heap), globals_(globals) {}
+
+    /*!
+     * \brief Decode the image and return the script function.
+     *
+     * \return \c nullptr, after printing an error to STDERR, if the image
+     *         is malformed.
+     */
+    obj::ObjFunction*
+    Load();
+
+    /*!
+     * \brief Mark the objects created so far, they are not reachable from
+     *        anywhere else until the script runs.
+     */
+    void
+    MarkRoots(obj::Heap& heap);
+
+private:
+    /*!
+     * \brief Return \c true and advance past \a count bytes if they are
+     *        available.
+     */
+    bool
+    Take(std::size_t count);
+
+    uint8_t
+    U8();
+
+    uint16_t
+    U16();
+
+    uint32_t
+    U32();
+
+    uint64_t
+    U64();
+
+    /*!
+     * \brief Print \a message to STDERR and make the decoding fail.
+     */
+    obj::ObjFunction*
+    Fail(const char* message);
+
+    /*!
+     * \brief Decode a function record into \a function.
+     */
+    bool
+    ReadFunction(obj::ObjFunction* function);
+
+    const uint8_t* cursor_;           /*!< Next byte to decode. */
+    const uint8_t* end_;              /*!< End of the image. */
+    const uint8_t* last_ = nullptr;   /*!< Start of the bytes consumed by the last Take(). */
+    bool           truncated_ = false; /*!< Set when a read runs past #end_. */
+    obj::Heap&     heap_;             /*!< Heap receiving the decoded objects. */
+    obj::Globals&  globals_;          /*!< Globals the image's slots are resolved in. */
+
+    std::vector<obj::ObjString*>   strings_;   /*!< Decoded string table. */
+    std::vector<obj::ObjFunction*> functions_; /*!< Decoded function table. */
+    std::vector<uint32_t>          caches_;    /*!< Inline cache count of each decoded function. */
+}; // end ImageReader
+
+bool
+ImageReader::Take(std::size_t count)
+{
+    if (truncated_ || (static_cast<std::size_t>(end_ - cursor_) < count)) {
+        truncated_ = true;
+        return false;
+    }
+    last_    = cursor_;
+    cursor_ += count;
+    return true;
+}
+
+uint8_t
+ImageReader::U8()
+{
+    return Take(1) ? last_[0] : 0;
+}
+
+uint16_t
+ImageReader::U16()
+{
+    if (!Take(2))
+        return 0;
+    return static_cast<uint16_t>(last_[0] | (last_[1] << 8));
+}
+
+uint32_t
+ImageReader::U32()
+{
+    if (!Take(4))
+        return 0;
+    return (static_cast<uint32_t>(last_[0]) |
+            (static_cast<uint32_t>(last_[1]) << 8) |
+            (static_cast<uint32_t>(last_[2]) << 16) |
+            (static_cast<uint32_t>(last_[3]) << 24));
+}
+
+uint64_t
+ImageReader::U64()
+{
+    uint64_t low = U32();
+    return (low | (static_cast<uint64_t>(U32()) << 32));
+}
+
+obj::ObjFunction*
+ImageReader::Fail(const char* message)
+{
+    std::fprintf(stderr, "error: %s\n",
+                 truncated_ ? "truncated bytecode image" : message);
+    return nullptr;
+}
+
+void
+ImageReader::MarkRoots(obj::Heap& heap)
+{
+    for (obj::ObjString* string : strings_)
+        heap.MarkObject(string);
+    for (obj::ObjFunction* function : functions_)
+        heap.MarkObject(function);
+}
+
+bool
+ImageReader::ReadFunction(obj::ObjFunction* function)
+{
+    uint32_t name = U32();
+    if (name != kNoName) {
+        if (name >= strings_.size())
+            return false;
+        function->name = strings_[name];
+    }
+    function->arity         = static_cast<int>(U32());
+    function->upvalue_count = static_cast<int>(U32());
+    function->max_slots     = static_cast<int>(U32());
+    if ((function->arity < 0) || (function->arity > UINT8_MAX) ||
+        (function->upvalue_count < 0) ||
+        (function->upvalue_count > UINT8_MAX + 1) ||
+        (function->max_slots <= function->arity))
+        return false;
+
+    /* The caches are only allocated once the code using them is verified,
+       every instruction owning one is at least 4 bytes long. */
+    Chunk& chunk = function->chunk;
+    uint32_t caches = U32();
+    uint32_t code_size = U32();
+    if ((caches > Chunk::kMaxInlineCaches) || (caches > code_size / 4) ||
+        !Take(code_size))
+        return false;
+    const uint8_t* code = last_;
+    caches_.push_back(caches);
+
+    uint32_t runs = U32();
+    std::size_t written = 0;
+    for (uint32_t i = 0; (i < runs) && !truncated_; ++i) {
+        int      line   = static_cast<int>(U32());
+        uint32_t length = U32();
+        if (length > code_size - written)
+            return false;
+        chunk.Write(code + written, length, line);
+        written += length;
+    }
+    if (written != code_size)
+        return false;
+
+    uint32_t constants = U32();
+    for (uint32_t i = 0; (i < constants) && !truncated_; ++i) {
+        switch (U8()) {
+            case ConstantTag::kTagNil:
+                chunk.AddConstant(val::NilVal());
+                break;
+            case ConstantTag::kTagFalse:
+                chunk.AddConstant(val::BoolVal(false));
+                break;
+            case ConstantTag::kTagTrue:
+                chunk.AddConstant(val::BoolVal(true));
+                break;
+            case ConstantTag::kTagNumber: {
+                uint64_t bits   = U64();
+                double   number = 0.0;
+                std::memcpy(&number, &bits, sizeof(number));
+                chunk.AddConstant(val::NumberVal(number));
+                break;
+            }
+            case ConstantTag::kTagString: {
+                uint32_t index = U32();
+                if (index >= strings_.size())
+                    return false;
+                chunk.AddConstant(obj::ObjVal(strings_[index]));
+                break;
+            }
+            case ConstantTag::kTagFunction: {
+                uint32_t index = U32();
+                if (index >= functions_.size())
+                    return false;
+                chunk.AddConstant(obj::ObjVal(functions_[index]));
+                break;
+            }
+            default:
+                return false;
+        }
+    }
+    return !truncated_;
+}
+
+obj::ObjFunction*
+ImageReader::Load()
+{
+    if (!Take(kMagicSize) || (0 != std::memcmp(last_, kImageMagic, kMagicSize)))
+        return Fail("not a bytecode image");
+    uint16_t version = U16();
+    U16();
+    if (truncated_)
+        return Fail("truncated bytecode image");
+    if (version != kImageVersion) {
+        std::fprintf(stderr,
+                     "error: bytecode image version %u, expected version %u\n",
+                     version, kImageVersion);
+        return nullptr;
+    }
+
+    /* Each object is recorded in a table, and so marked, before the next
+       allocation can trigger a collection. */
+    uint32_t string_count = U32();
+    for (uint32_t i = 0; (i < string_count) && !truncated_; ++i) {
+        uint32_t length = U32();
+        if (!Take(length))
+            break;
+        std::string_view chars(reinterpret_cast<const char*>(last_), length);
+        strings_.push_back(obj::CopyString(heap_, chars));
+    }
+
+    uint32_t global_count = U32();
+    for (uint32_t slot = 0; (slot < global_count) && !truncated_; ++slot) {
+        uint32_t name = U32();
+        if (name >= strings_.size())
+            return Fail("invalid global variable name");
+        if (globals_.Resolve(strings_[name]) != slot)
+            return Fail("bytecode image globals do not match the VM's");
+    }
+
+    /* Bound the count before allocating: a function record is at least
+       kMinFunctionSize bytes. */
+    uint32_t function_count = U32();
+    if (truncated_ || (0 == function_count))
+        return Fail("bytecode image has no script");
+    if (function_count > static_cast<std::size_t>(end_ - cursor_) /
+                             kMinFunctionSize)
+        return Fail("truncated bytecode image");
+    for (uint32_t i = 0; i < function_count; ++i)
+        functions_.push_back(obj::NewFunction(heap_));
+    for (obj::ObjFunction* function : functions_) {
+        if (!ReadFunction(function))
+            return Fail("malformed function in bytecode image");
+    }
+
+    /* Closures read the upvalue count of the function they create, so the
+       code is checked once every function is decoded. */
+    for (std::size_t i = 0; i < functions_.size(); ++i) {
+        obj::ObjFunction* function = functions_[i];
+        Chunk& chunk = function->chunk;
+        if (!chunk.Verify(function->arity, function->upvalue_count,
+                          globals_.Size(), caches_[i]) ||
+            (function->max_slots != chunk.MaxStackSlots(function->arity + 1)))
+            return Fail("invalid bytecode in bytecode image");
+        for (uint32_t cache = 0; cache < caches_[i]; ++cache)
+            chunk.AddInlineCache();
+    }
+
+    return functions_.front();
+}
+} // end anonymous namespace
+
+bool
+IsImage(const std::string& path)
+{
+    std::ifstream file(path, std::ios::binary);
+    char magic[kMagicSize] = {};
+    file.read(magic, kMagicSize);
+    return (file && (0 == std::memcmp(magic, kImageMagic, kMagicSize)));
+}
+
+bool
+WriteImage(const obj::ObjFunction* script,
+           const obj::Globals& globals,
+           const std::string& path)
+{
+    std::vector<uint8_t> image = ImageWriter().Write(script, globals);
+
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(image.data()), image.size());
+    file.close();
+    if (!file) {
+        std::fprintf(stderr, "error: unable to write image '%s'\n",
+                     path.c_str());
+        return false;
+    }
+    return true;
+}
+
+obj::ObjFunction*
+LoadImage(const std::string& path, obj::Heap& heap, obj::Globals& globals)
+{
+    MappedFile file(path);
+    if (!file.IsOpen()) {
+        std::fprintf(stderr, "error: unable to open image '%s'\n",
+                     path.c_str());
+        return nullptr;
+    }
+
+    ImageReader reader(file.Data(), file.Size(), heap, globals);
+    heap.PushRootMarker([&reader](obj::Heap& h) { reader.MarkRoots(h); });
+    obj::ObjFunction* script = reader.Load();
+    heap.PopRootMarker();
+
+    return script;
+}
+} // end img
+} // end lox
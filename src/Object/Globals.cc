@@ -0,0 +1,23 @@
+#include "Object.h"
+#include "Globals.h"
+
+namespace lox
+{
+namespace obj
+{
+std::size_t
+Globals::Resolve(ObjString* name)
+{
+    val::Value slot;
+    if (slots_.Get(name, &slot))
+        return static_cast<std::size_t>(val::AsNumber(slot));
+
+    std::size_t index = values_.size();
+    slots_.Set(name, val::NumberVal(static_cast<double>(index)));
+    names_.push_back(name);
+    values_.push_back(val::UndefinedVal());
+
+    return index;
+}
+} // end obj
+} // end lox
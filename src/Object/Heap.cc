@@ -0,0 +1,260 @@
+#include <cstdio>
+#include <cstddef>
+
+#include "Value.h"
+#include "Object.h"
+#include "Heap.h"
+
+namespace lox
+{
+namespace obj
+{
+Heap::Heap(std::size_t gc_threshold, std::size_t gc_grow_factor) :
+    objects_(nullptr),
+    bytes_allocated_(0),
+    next_gc_(gc_threshold),
+    gc_grow_factor_(gc_grow_factor)
+{
+
+}
+
+Heap::~Heap()
+{
+    Obj* object = objects_;
+    while (object) {
+        Obj* next = object->next;
+        FreeObject(object);
+        object = next;
+    }
+}
+
+void
+Heap::Track(Obj* object, std::size_t size)
+{
+#ifdef DEBUG_STRESS_GC
+    CollectGarbage();
+#else
+    if ((bytes_allocated_ + size) > next_gc_)
+        CollectGarbage();
+#endif
+
+    object->is_marked = false;
+    object->next      = objects_;
+    objects_          = object;
+    bytes_allocated_ += size;
+    stats_.allocations++;
+    stats_.allocated_bytes += size;
+
+#ifdef DEBUG_LOG_GC
+    std::printf("%p allocate %zu for %d\n",
+                static_cast<void*>(object), size, object->type);
+#endif
+}
+
+void
+Heap::CollectGarbage()
+{
+#ifdef DEBUG_LOG_GC
+    std::printf("-- gc begin\n");
+    std::size_t before = bytes_allocated_;
+#endif
+
+    stats_.collections++;
+    for (const RootMarker& marker : root_markers_)
+        marker(*this);
+    empty_shape_.Mark(*this);
+
+    TraceReferences();
+    RemoveWhiteStrings();
+    Sweep();
+
+    next_gc_ = bytes_allocated_ * gc_grow_factor_;
+
+#ifdef DEBUG_LOG_GC
+    std::printf("-- gc end\n");
+    std::printf("   collected %zu bytes (from %zu to %zu) next at %zu\n",
+                before - bytes_allocated_, before, bytes_allocated_,
+                next_gc_);
+#endif
+}
+
+void
+Heap::MarkObject(Obj* object)
+{
+    if (!object || object->is_marked)
+        return;
+
+#ifdef DEBUG_LOG_GC
+    std::printf("%p mark ", static_cast<void*>(object));
+    val::PrintValue(ObjVal(object));
+    std::printf("\n");
+#endif
+
+    object->is_marked = true;
+    gray_stack_.push_back(object);
+}
+
+void
+Heap::MarkValue(const val::Value& value)
+{
+    if (IsObject(value))
+        MarkObject(AsObj(value));
+}
+
+void
+Heap::MarkTable(const Table& table)
+{
+    for (const Table::Entry& entry : table.Entries()) {
+        MarkObject(entry.key);
+        MarkValue(entry.value);
+    }
+}
+
+void
+Heap::BlackenObject(Obj* object)
+{
+#ifdef DEBUG_LOG_GC
+    std::printf("%p blacken ", static_cast<void*>(object));
+    val::PrintValue(ObjVal(object));
+    std::printf("\n");
+#endif
+
+    switch (object->type) {
+        case ObjType::kObjBoundMethod: {
+            ObjBoundMethod* bound = static_cast<ObjBoundMethod*>(object);
+            MarkValue(bound->receiver);
+            MarkObject(bound->method);
+            break;
+        }
+        case ObjType::kObjClass: {
+            ObjClass* klass = static_cast<ObjClass*>(object);
+            MarkObject(klass->name);
+            MarkTable(klass->methods);
+            break;
+        }
+        case ObjType::kObjClosure: {
+            ObjClosure* closure = static_cast<ObjClosure*>(object);
+            MarkObject(closure->function);
+            for (ObjUpvalue* upvalue : closure->upvalues)
+                MarkObject(upvalue);
+            break;
+        }
+        case ObjType::kObjFunction: {
+            ObjFunction* function = static_cast<ObjFunction*>(object);
+            MarkObject(function->name);
+            for (const val::Value& constant : function->chunk.GetConstants())
+                MarkValue(constant);
+            /* Cached classes are kept alive so that a new class allocated
+               at the same address can never produce a false hit. */
+            for (const Chunk::InlineCache& cache :
+                 function->chunk.GetInlineCaches()) {
+                MarkObject(cache.klass);
+                MarkObject(cache.method);
+            }
+            break;
+        }
+        case ObjType::kObjInstance: {
+            ObjInstance* instance = static_cast<ObjInstance*>(object);
+            MarkObject(instance->klass);
+            for (const val::Value& field : instance->fields)
+                MarkValue(field);
+            break;
+        }
+        case ObjType::kObjUpvalue:
+            MarkValue(static_cast<ObjUpvalue*>(object)->closed);
+            break;
+        case ObjType::kObjString: {
+            ObjString* string = static_cast<ObjString*>(object);
+            MarkObject(string->left);
+            MarkObject(string->right);
+            MarkObject(string->flat);
+            break;
+        }
+        case ObjType::kObjNative:
+            break;
+    }
+}
+
+void
+Heap::TraceReferences()
+{
+    while (!gray_stack_.empty()) {
+        Obj* object = gray_stack_.back();
+        gray_stack_.pop_back();
+        BlackenObject(object);
+    }
+}
+
+void
+Heap::RemoveWhiteStrings()
+{
+    strings_.RemoveWhite();
+}
+
+void
+Heap::Sweep()
+{
+    Obj* previous = nullptr;
+    Obj* object   = objects_;
+    while (object) {
+        if (object->is_marked) {
+            object->is_marked = false;
+            previous = object;
+            object   = object->next;
+        } else {
+            Obj* unreached = object;
+            object = object->next;
+            if (previous)
+                previous->next = object;
+            else
+                objects_ = object;
+
+            FreeObject(unreached);
+        }
+    }
+}
+
+void
+Heap::FreeObject(Obj* object)
+{
+#ifdef DEBUG_LOG_GC
+    std::printf("%p free type %d\n", static_cast<void*>(object), object->type);
+#endif
+
+    std::size_t size = 0;
+    switch (object->type) {
+        case ObjType::kObjBoundMethod:
+            size = Destroy(static_cast<ObjBoundMethod*>(object));
+            break;
+        case ObjType::kObjClass:
+            size = Destroy(static_cast<ObjClass*>(object));
+            break;
+        case ObjType::kObjClosure: {
+            ObjClosure* closure = static_cast<ObjClosure*>(object);
+            size = closure->upvalue_count * sizeof(ObjUpvalue*);
+            size += Destroy(closure);
+            break;
+        }
+        case ObjType::kObjFunction:
+            size = Destroy(static_cast<ObjFunction*>(object));
+            break;
+        case ObjType::kObjInstance:
+            size = Destroy(static_cast<ObjInstance*>(object));
+            break;
+        case ObjType::kObjNative:
+            size = Destroy(static_cast<ObjNative*>(object));
+            break;
+        case ObjType::kObjString: {
+            ObjString* str = static_cast<ObjString*>(object);
+            size = Destroy(str, IsRope(str) ? 0 : str->length + 1);
+            break;
+        }
+        case ObjType::kObjUpvalue:
+            size = Destroy(static_cast<ObjUpvalue*>(object));
+            break;
+    }
+    bytes_allocated_ -= size;
+    stats_.frees++;
+}
+} // end obj
+} // end lox
@@ -1,8 +1,12 @@
 #include <cstdio>
+#include <cstring>
 #include <string>
+#include <utility>
 #include <variant>
+#include <vector>
 
 #include "Object.h"
+#include "Heap.h"
 
 namespace lox
 {
@@ -12,49 +16,73 @@ ObjType
 GetType(const val::Value& value)
     { return AsObj(value)->type; }
 
-val::Value
-ObjVal(std::shared_ptr<Obj> value)
-    { return val::Value{val::ValueType::kObj, value}; }
-
-std::shared_ptr<Obj>
-AsObj(const val::Value& value)
-    { return std::get<std::shared_ptr<Obj>>(value.as); }
-
-std::shared_ptr<ObjString>
+ObjString*
 AsString(const val::Value& value)
-    { return std::static_pointer_cast<ObjString>(AsObj(value)); }
+    { return static_cast<ObjString*>(AsObj(value)); }
 
-std::shared_ptr<ObjFunction>
+ObjFunction*
 AsFunction(const val::Value& value)
-    { return std::static_pointer_cast<ObjFunction>(AsObj(value)); }
+    { return static_cast<ObjFunction*>(AsObj(value)); }
 
-NativeFn
+const NativeFn&
 AsNative(const val::Value& value)
-    { return std::static_pointer_cast<ObjNative>(AsObj(value))->function; }
+    { return static_cast<ObjNative*>(AsObj(value))->function; }
 
-std::shared_ptr<ObjClosure>
+ObjClosure*
 AsClosure(const val::Value& value)
-    { return std::static_pointer_cast<ObjClosure>(AsObj(value)); }
+    { return static_cast<ObjClosure*>(AsObj(value)); }
 
-std::shared_ptr<ObjClass>
+ObjClass*
 AsClass(const val::Value& value)
-    { return std::static_pointer_cast<ObjClass>(AsObj(value)); }
+    { return static_cast<ObjClass*>(AsObj(value)); }
 
-std::shared_ptr<ObjInstance>
+ObjInstance*
 AsInstance(const val::Value& value)
-    { return std::static_pointer_cast<ObjInstance>(AsObj(value)); }
+    { return static_cast<ObjInstance*>(AsObj(value)); }
 
-std::shared_ptr<ObjBoundMethod>
+ObjBoundMethod*
 AsBoundMethod(const val::Value& value)
-    { return std::static_pointer_cast<ObjBoundMethod>(AsObj(value)); }
+    { return static_cast<ObjBoundMethod*>(AsObj(value)); }
+
+/*!
+ * \brief Append the characters of \a string, a rope or a flat string, to
+ *        \a chars.
+ */
+static void
+AppendChars(const ObjString* string, std::string& chars)
+{
+    /* Ropes built by a loop are as deep as the loop is long, walk them
+       with an explicit stack. */
+    std::vector<const ObjString*> pending(1, string);
+    while (!pending.empty()) {
+        const ObjString* piece = pending.back();
+        pending.pop_back();
+        if (piece->flat)
+            piece = piece->flat;
+
+        if (piece->left) {
+            pending.push_back(piece->right);
+            pending.push_back(piece->left);
+        } else {
+            chars.append(piece->Chars(), piece->length);
+        }
+    }
+}
 
 std::string
 AsStdString(const val::Value& value)
-    { return std::static_pointer_cast<ObjString>(AsObj(value))->chars; }
+{
+    const ObjString* string = static_cast<ObjString*>(AsObj(value));
+    if (!string->left) {
+        const ObjString* flat = string->flat ? string->flat : string;
+        return std::string(flat->Chars(), flat->length);
+    }
 
-bool
-IsObject(const val::Value& value)
-    { return (value.type == val::ValueType::kObj); }
+    std::string chars;
+    chars.reserve(string->length);
+    AppendChars(string, chars);
+    return chars;
+}
 
 bool
 IsObjType(const val::Value& value, ObjType type)
@@ -88,65 +116,120 @@ bool
 IsBoundMethod(const val::Value& value)
     { return IsObjType(value, ObjType::kObjBoundMethod); }
 
-std::shared_ptr<ObjString> CopyString(
-    const std::string& str,
-    std::shared_ptr<std::unordered_map<std::string, std::shared_ptr<ObjString>>>
-        strs)
+uint32_t
+HashString(const char* key, std::size_t length)
 {
-    if (strs->find(str) != strs->end())
-        return strs->at(str);
+    uint32_t hash = 2166136261u;
+    for (std::size_t i = 0; i < length; ++i) {
+        hash ^= static_cast<uint8_t>(key[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
 
-    std::shared_ptr<ObjString> str_obj = std::make_shared<ObjString>();
-    str_obj->type  = ObjType::kObjString;
-    str_obj->chars = str;
+/*!
+ * \brief Allocate an ObjString holding \a chars and intern it.
+ */
+static ObjString*
+AllocateString(Heap& heap, std::string_view chars, uint32_t hash)
+{
+    ObjString* str_obj =
+        heap.Allocate<ObjString>(ObjType::kObjString, 0, chars.size() + 1);
+    str_obj->length = chars.size();
+    str_obj->hash   = hash;
+    std::memcpy(str_obj->Chars(), chars.data(), chars.size());
+    str_obj->Chars()[chars.size()] = '\0';
 
     /* Insert the newly formed ObjString into the intern string table. */
-    (*strs)[str] = str_obj;
+    heap.Strings().Set(str_obj, val::NilVal());
 
     return str_obj;
 }
 
-std::shared_ptr<ObjFunction>
-NewFunction()
+ObjString*
+CopyString(Heap& heap, std::string_view str)
+{
+    uint32_t hash = HashString(str.data(), str.size());
+    ObjString* interned =
+        heap.Strings().FindString(str.data(), str.size(), hash);
+    if (interned)
+        return interned;
+
+    return AllocateString(heap, str, hash);
+}
+
+ObjString*
+NewRope(Heap& heap, ObjString* left, ObjString* right)
+{
+    ObjString* rope = heap.Allocate<ObjString>(ObjType::kObjString);
+    /* Skip flattened ropes so they can be collected. */
+    rope->left   = left->flat ? left->flat : left;
+    rope->right  = right->flat ? right->flat : right;
+    rope->length = left->length + right->length;
+
+    return rope;
+}
+
+ObjString*
+FlattenString(Heap& heap, ObjString* string)
+{
+    if (!string->left)
+        return string->flat ? string->flat : string;
+
+    std::string chars;
+    chars.reserve(string->length);
+    AppendChars(string, chars);
+
+    /* The operands stay reachable through the rope until it forwards to
+       its flat string. */
+    ObjString* flat = CopyString(heap, chars);
+    string->flat  = flat;
+    string->left  = nullptr;
+    string->right = nullptr;
+    return flat;
+}
+
+ObjFunction*
+NewFunction(Heap& heap)
 {
-    std::shared_ptr<ObjFunction> function = std::make_shared<ObjFunction>();
-    function->type          = ObjType::kObjFunction;
+    ObjFunction* function =
+        heap.Allocate<ObjFunction>(ObjType::kObjFunction);
     function->arity         = 0;
     function->upvalue_count = 0;
+    function->max_slots     = 0;
     function->name          = nullptr;
 
     return function;
 }
 
-std::shared_ptr<ObjNative>
-NewNative(NativeFn function)
+ObjNative*
+NewNative(Heap& heap, NativeFn function)
 {
-    std::shared_ptr<ObjNative> native = std::make_shared<ObjNative>();
-    native->type     = ObjType::kObjNative;
+    ObjNative* native = heap.Allocate<ObjNative>(ObjType::kObjNative);
     native->function = function;
 
     return native;
 }
 
-std::shared_ptr<ObjClosure>
-NewClosure(std::shared_ptr<ObjFunction> function)
+ObjClosure*
+NewClosure(Heap& heap, ObjFunction* function)
 {
-    std::shared_ptr<ObjClosure> closure = std::make_shared<ObjClosure>();
-    closure->type     = ObjType::kObjClosure;
-    closure->function = function;
-    closure->upvalues =
-        std::vector<std::shared_ptr<ObjUpvalue>>(
-            function->upvalue_count, std::make_shared<ObjUpvalue>());
+    ObjClosure* closure =
+        heap.Allocate<ObjClosure>(
+            ObjType::kObjClosure,
+            function->upvalue_count * sizeof(ObjUpvalue*));
+    closure->function      = function;
+    closure->upvalues      =
+        std::vector<ObjUpvalue*>(function->upvalue_count, nullptr);
     closure->upvalue_count = function->upvalue_count;
 
     return closure;
 }
 
-std::shared_ptr<ObjUpvalue>
-NewUpvalue(val::Value* slot)
+ObjUpvalue*
+NewUpvalue(Heap& heap, val::Value* slot)
 {
-    std::shared_ptr<ObjUpvalue> upvalue = std::make_shared<ObjUpvalue>();
-    upvalue->type     = ObjType::kObjUpvalue;
+    ObjUpvalue* upvalue = heap.Allocate<ObjUpvalue>(ObjType::kObjUpvalue);
     upvalue->location = slot;
     upvalue->closed   = val::NilVal();
     upvalue->next     = nullptr;
@@ -154,33 +237,34 @@ NewUpvalue(val::Value* slot)
     return upvalue;
 }
 
-std::shared_ptr<ObjClass>
-NewClass(std::shared_ptr<ObjString> name)
+ObjClass*
+NewClass(Heap& heap, ObjString* name)
 {
-    std::shared_ptr<ObjClass> klass = std::make_shared<ObjClass>();
-    klass->type = ObjType::kObjClass;
+    ObjClass* klass = heap.Allocate<ObjClass>(ObjType::kObjClass);
     klass->name = name;
 
     return klass;
 }
 
-std::shared_ptr<ObjInstance>
-NewInstance(std::shared_ptr<ObjClass> klass)
+ObjInstance*
+NewInstance(Heap& heap, ObjClass* klass)
 {
-    std::shared_ptr<ObjInstance> instance = std::make_shared<ObjInstance>();
-    instance->type  = ObjType::kObjInstance;
+    ObjInstance* instance =
+        heap.Allocate<ObjInstance>(ObjType::kObjInstance);
     instance->klass = klass;
+    instance->shape = heap.EmptyShape();
 
     return instance;
 }
 
-std::shared_ptr<ObjBoundMethod>
+ObjBoundMethod*
 NewBoundMethod(
+    Heap& heap,
     const val::Value& receiver,
-    std::shared_ptr<ObjClosure> method)
+    ObjClosure* method)
 {
-    std::shared_ptr<ObjBoundMethod> bound = std::make_shared<ObjBoundMethod>();
-    bound->type     = ObjType::kObjBoundMethod;
+    ObjBoundMethod* bound =
+        heap.Allocate<ObjBoundMethod>(ObjType::kObjBoundMethod);
     bound->receiver = receiver;
     bound->method   = method;
 
@@ -188,13 +272,13 @@ NewBoundMethod(
 }
 
 void
-PrintFunction(std::shared_ptr<ObjFunction> function)
+PrintFunction(const ObjFunction* function)
 {
     if (!function->name) {
         std::printf("<script>");
         return;
     }
-    std::printf("<fn %s>", function->name->chars.c_str());
+    std::printf("<fn %s>", function->name->Chars());
 }
 } // end obj
 } // end lox
@@ -0,0 +1,69 @@
+#include <new>
+#include <cstddef>
+#include <memory>
+
+#include "ObjectPool.h"
+
+namespace lox
+{
+namespace obj
+{
+#ifdef OBJECT_POOL
+void*
+ObjectPool::Allocate(std::size_t size)
+{
+    if (size > kMaxBlockSize)
+        return ::operator new(size);
+
+    std::size_t size_class = (size - 1) / kGranularity;
+    if (FreeBlock* block = free_lists_[size_class]) {
+        free_lists_[size_class] = block->next;
+        return block;
+    }
+
+    std::size_t block_size = (size_class + 1) * kGranularity;
+    std::size_t left       = static_cast<std::size_t>(bump_end_ - bump_);
+    if (left < block_size) {
+        /* Slabs and blocks are multiples of kGranularity, so the tail of
+           the slab is a whole block of a smaller size class. */
+        if (left > 0) {
+            std::size_t tail_class = left / kGranularity - 1;
+            free_lists_[tail_class] =
+                new (bump_) FreeBlock{free_lists_[tail_class]};
+        }
+        slabs_.emplace_back(new std::byte[kSlabSize]);
+        bump_     = slabs_.back().get();
+        bump_end_ = bump_ + kSlabSize;
+    }
+
+    void* block = bump_;
+    bump_ += block_size;
+    return block;
+}
+
+void
+ObjectPool::Free(void* block, std::size_t size)
+{
+    if (size > kMaxBlockSize) {
+        ::operator delete(block);
+        return;
+    }
+
+    std::size_t size_class = (size - 1) / kGranularity;
+    free_lists_[size_class] = new (block) FreeBlock{free_lists_[size_class]};
+}
+#else
+void*
+ObjectPool::Allocate(std::size_t size)
+{
+    return ::operator new(size);
+}
+
+void
+ObjectPool::Free(void* block, [[maybe_unused]] std::size_t size)
+{
+    ::operator delete(block);
+}
+#endif
+} // end obj
+} // end lox
@@ -0,0 +1,45 @@
+#include "Object.h"
+#include "Heap.h"
+#include "Shape.h"
+
+namespace lox
+{
+namespace obj
+{
+int
+Shape::Lookup(const ObjString* name) const
+{
+    val::Value index;
+    if (!slots_.Get(name, &index))
+        return -1;
+    return static_cast<int>(val::AsNumber(index));
+}
+
+Shape*
+Shape::Transition(ObjString* name)
+{
+    /* Most shapes have a single child so a linear scan beats hashing. */
+    for (const auto& transition : transitions_) {
+        if (transition.first == name)
+            return transition.second.get();
+    }
+
+    ShapePtr child = std::make_unique<Shape>();
+    child->slots_ = slots_;
+    child->slots_.Set(name, val::NumberVal(static_cast<double>(size_)));
+    child->size_  = size_ + 1;
+
+    transitions_.emplace_back(name, std::move(child));
+    return transitions_.back().second.get();
+}
+
+void
+Shape::Mark(Heap& heap) const
+{
+    for (const auto& transition : transitions_) {
+        heap.MarkObject(transition.first);
+        transition.second->Mark(heap);
+    }
+}
+} // end obj
+} // end lox
@@ -0,0 +1,147 @@
+#include <cstring>
+#include <utility>
+
+#include "Object.h"
+#include "Table.h"
+
+namespace lox
+{
+namespace obj
+{
+/* Grow once live entries plus tombstones exceed 3/4 of the capacity. */
+static constexpr std::size_t kMaxLoadNumerator   = 3;
+static constexpr std::size_t kMaxLoadDenominator = 4;
+
+std::size_t
+Table::FindEntry(const std::vector<Entry>& entries, const ObjString* key)
+{
+    const std::size_t mask = entries.size() - 1;
+    std::size_t index = key->hash & mask;
+    std::size_t tombstone = entries.size();
+
+    while (true) {
+        const Entry& entry = entries[index];
+        if (!entry.key) {
+            if (val::IsNil(entry.value))
+                return (tombstone != entries.size()) ? tombstone : index;
+            if (tombstone == entries.size())
+                tombstone = index;
+        } else if (entry.key == key) {
+            return index;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+bool
+Table::Get(const ObjString* key, val::Value* value) const
+{
+    if (0 == count_)
+        return false;
+
+    const Entry& entry = entries_[FindEntry(entries_, key)];
+    if (!entry.key)
+        return false;
+
+    *value = entry.value;
+    return true;
+}
+
+bool
+Table::Set(ObjString* key, const val::Value& value)
+{
+    if ((count_ + 1) * kMaxLoadDenominator >
+        entries_.size() * kMaxLoadNumerator) {
+        AdjustCapacity(entries_.empty() ? kMinCapacity
+                                        : entries_.size() * 2);
+    }
+
+    Entry& entry = entries_[FindEntry(entries_, key)];
+    bool is_new_key = !entry.key;
+    /* Reusing a tombstone does not change the count, it was already
+       included. */
+    if (is_new_key && val::IsNil(entry.value))
+        count_++;
+
+    entry.key   = key;
+    entry.value = value;
+    return is_new_key;
+}
+
+bool
+Table::Delete(const ObjString* key)
+{
+    if (0 == count_)
+        return false;
+
+    Entry& entry = entries_[FindEntry(entries_, key)];
+    if (!entry.key)
+        return false;
+
+    entry.key   = nullptr;
+    entry.value = val::BoolVal(true);
+    return true;
+}
+
+void
+Table::AddAll(const Table& from)
+{
+    for (const Entry& entry : from.entries_) {
+        if (entry.key)
+            Set(entry.key, entry.value);
+    }
+}
+
+ObjString*
+Table::FindString(
+    const char* chars,
+    std::size_t length,
+    uint32_t hash) const
+{
+    if (0 == count_)
+        return nullptr;
+
+    const std::size_t mask = entries_.size() - 1;
+    std::size_t index = hash & mask;
+    while (true) {
+        const Entry& entry = entries_[index];
+        if (!entry.key) {
+            /* Stop at an empty slot, skip over tombstones. */
+            if (val::IsNil(entry.value))
+                return nullptr;
+        } else if ((entry.key->hash == hash) &&
+                   (entry.key->length == length) &&
+                   (0 == std::memcmp(entry.key->Chars(), chars,
+                                     length))) {
+            return entry.key;
+        }
+        index = (index + 1) & mask;
+    }
+}
+
+void
+Table::RemoveWhite()
+{
+    for (Entry& entry : entries_) {
+        if (entry.key && !entry.key->is_marked)
+            Delete(entry.key);
+    }
+}
+
+void
+Table::AdjustCapacity(std::size_t capacity)
+{
+    std::vector<Entry> entries(capacity, Entry{nullptr, val::NilVal()});
+
+    count_ = 0;
+    for (const Entry& entry : entries_) {
+        if (!entry.key)
+            continue;
+
+        entries[FindEntry(entries, entry.key)] = entry;
+        count_++;
+    }
+    entries_ = std::move(entries);
+}
+} // end obj
+} // end lox
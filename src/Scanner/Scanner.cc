@@ -1,5 +1,6 @@
 #include <cctype>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 
 #include "Scanner.h"
@@ -61,7 +62,7 @@ Token::Token() :
 
 }
 
-Token::Token(TokenType type, const std::string& lexeme, int line) :
+Token::Token(TokenType type, std::string_view lexeme, int line) :
     type_(type),
     lexeme_(lexeme),
     line_(line)
@@ -69,34 +70,13 @@ Token::Token(TokenType type, const std::string& lexeme, int line) :
 
 }
 
-const std::unordered_map<std::string, Token::TokenType>
-Scanner::kKeywords_ =
-{
-    {"and",    Token::TokenType::kAnd},
-    {"class",  Token::TokenType::kClass},
-    {"else",   Token::TokenType::kElse},
-    {"false",  Token::TokenType::kFalse},
-    {"for",    Token::TokenType::kFor},
-    {"fun",    Token::TokenType::kFun},
-    {"if",     Token::TokenType::kIf},
-    {"nil",    Token::TokenType::kNil},
-    {"or",     Token::TokenType::kOr},
-    {"print",  Token::TokenType::kPrint},
-    {"return", Token::TokenType::kReturn},
-    {"super",  Token::TokenType::kSuper},
-    {"this",   Token::TokenType::kThis},
-    {"true",   Token::TokenType::kTrue},
-    {"var",    Token::TokenType::kVar},
-    {"while",  Token::TokenType::kWhile}
-};
-
 char
 Scanner::Peek() const
 {
     if (IsAtEnd())
         return '\0';
 
-    return source_.at(current_);
+    return source_[current_];
 }
 
 char
@@ -105,7 +85,7 @@ Scanner::PeekNext() const
     if ((current_ + 1) >= source_.size())
         return '\0';
 
-    return source_.at(current_ + 1);
+    return source_[current_ + 1];
 }
 
 bool
@@ -189,14 +169,60 @@ Scanner::Identifier()
     while (IsAlpha(Peek()) || IsDigit(Peek()))
         Advance();
 
-    std::string candidate = SourceSubstring(start_, current_);
-    if (kKeywords_.find(candidate) != kKeywords_.end())
-        return MakeToken(kKeywords_.at(candidate));
+    return MakeToken(IdentifierType());
+}
 
-    return MakeToken(Token::TokenType::kIdentifier);
+Token::TokenType
+Scanner::CheckKeyword(
+    uint32_t start,
+    std::string_view rest,
+    Token::TokenType type) const
+{
+    if (((current_ - start_) == (start + rest.size())) &&
+        (SourceSubstring(start_ + start, current_) == rest)) {
+        return type;
+    }
+    return Token::TokenType::kIdentifier;
+}
+
+Token::TokenType
+Scanner::IdentifierType() const
+{
+    using TokenType = Token::TokenType;
+    switch (source_[start_]) {
+        case 'a': return CheckKeyword(1, "nd", TokenType::kAnd);
+        case 'c': return CheckKeyword(1, "lass", TokenType::kClass);
+        case 'e': return CheckKeyword(1, "lse", TokenType::kElse);
+        case 'f':
+            if ((current_ - start_) > 1) {
+                switch (source_[start_ + 1]) {
+                    case 'a': return CheckKeyword(2, "lse", TokenType::kFalse);
+                    case 'o': return CheckKeyword(2, "r", TokenType::kFor);
+                    case 'u': return CheckKeyword(2, "n", TokenType::kFun);
+                }
+            }
+            break;
+        case 'i': return CheckKeyword(1, "f", TokenType::kIf);
+        case 'n': return CheckKeyword(1, "il", TokenType::kNil);
+        case 'o': return CheckKeyword(1, "r", TokenType::kOr);
+        case 'p': return CheckKeyword(1, "rint", TokenType::kPrint);
+        case 'r': return CheckKeyword(1, "eturn", TokenType::kReturn);
+        case 's': return CheckKeyword(1, "uper", TokenType::kSuper);
+        case 't':
+            if ((current_ - start_) > 1) {
+                switch (source_[start_ + 1]) {
+                    case 'h': return CheckKeyword(2, "is", TokenType::kThis);
+                    case 'r': return CheckKeyword(2, "ue", TokenType::kTrue);
+                }
+            }
+            break;
+        case 'v': return CheckKeyword(1, "ar", TokenType::kVar);
+        case 'w': return CheckKeyword(1, "hile", TokenType::kWhile);
+    }
+    return TokenType::kIdentifier;
 }
 
-Scanner::Scanner(const std::string& source) :
+Scanner::Scanner(std::string_view source) :
     start_(0),
     current_(0),
     line_(1),
@@ -7,15 +7,7 @@ namespace lox
 {
 namespace val
 {
-Value
-BoolVal(bool value) { return {ValueType::kBool, value}; }
-
-Value
-NilVal() { return {ValueType::kNil, 0.0}; }
-
-Value
-NumberVal(double value) { return {ValueType::kNumber, value}; }
-
+#ifndef NAN_BOXING
 bool
 ValuesEqual(const Value& a, const Value& b)
 {
@@ -36,21 +28,7 @@ ValuesEqual(const Value& a, const Value& b)
             return false;
     }
 }
-
-bool
-AsBool(const Value& value) { return std::get<bool>(value.as); }
-
-double
-AsNumber(const Value& value) { return std::get<double>(value.as); }
-
-bool
-IsBool(const Value& value) { return (value.type == ValueType::kBool); }
-
-bool
-IsNil(const Value& value) { return (value.type == ValueType::kNil); }
-
-bool
-IsNumber(const Value& value) { return (value.type == ValueType::kNumber); }
+#endif
 
 void
 PrintObject(const Value& value)
@@ -72,11 +50,11 @@ PrintObject(const Value& value)
             std::printf("upvalue");
             break;
         case obj::ObjType::kObjClass:
-            std::printf("%s", obj::AsClass(value)->name->chars.c_str());
+            std::printf("%s", obj::AsClass(value)->name->Chars());
             break;
         case obj::ObjType::kObjInstance:
             std::printf("%s instance",
-                        obj::AsInstance(value)->klass->name->chars.c_str());
+                        obj::AsInstance(value)->klass->name->Chars());
             break;
         case obj::ObjType::kObjBoundMethod:
             obj::PrintFunction(obj::AsBoundMethod(value)->method->function);
@@ -87,20 +65,14 @@ PrintObject(const Value& value)
 void
 PrintValue(const Value& value)
 {
-    switch (value.type) {
-        case ValueType::kBool:
-            std::printf(AsBool(value) ? "true" : "false");
-            break;
-        case ValueType::kNil:
-            std::printf("nil");
-            break;
-        case ValueType::kNumber:
-            std::printf("%g", AsNumber(value));
-            break;
-        case ValueType::kObj:
-            PrintObject(value);
-            break;
-    }
+    if (IsBool(value))
+        std::printf(AsBool(value) ? "true" : "false");
+    else if (IsNil(value))
+        std::printf("nil");
+    else if (IsNumber(value))
+        std::printf("%g", AsNumber(value));
+    else if (obj::IsObject(value))
+        PrintObject(value);
 }
 } // end val
 } // end lox
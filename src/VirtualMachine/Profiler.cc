@@ -0,0 +1,299 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <utility>
+#include <algorithm>
+
+#include "Chunk.h"
+#include "Object.h"
+#include "Heap.h"
+#include "Profiler.h"
+
+namespace lox
+{
+namespace vm
+{
+namespace
+{
+/*!
+ * \struct Row
+ * \brief The Row struct accumulates one line of a Report() table.
+ */
+struct Row
+{
+    uint64_t count = 0; /*!< Instructions executed. */
+    uint64_t nanos = 0; /*!< Self time. */
+}; // end Row
+
+double
+Millis(uint64_t nanos)
+{
+    return static_cast<double>(nanos) / 1e6;
+}
+
+double
+Percent(uint64_t part, uint64_t total)
+{
+    return total ? (100.0 * static_cast<double>(part) / total) : 0.0;
+}
+
+/*!
+ * \brief Return the keys of \a rows sorted by decreasing time, then count.
+ */
+template <typename Key>
+std::vector<Key>
+SortByTime(const std::map<Key, Row>& rows)
+{
+    std::vector<Key> keys;
+    keys.reserve(rows.size());
+    for (const auto& row : rows)
+        keys.push_back(row.first);
+
+    std::stable_sort(keys.begin(), keys.end(),
+                     [&rows](const Key& a, const Key& b) {
+        const Row& ra = rows.at(a);
+        const Row& rb = rows.at(b);
+        return (ra.nanos != rb.nanos) ? (ra.nanos > rb.nanos)
+                                      : (ra.count > rb.count);
+    });
+    return keys;
+}
+} // end anonymous namespace
+
+void
+Profiler::Enter(obj::ObjFunction* function, int depth)
+{
+    std::size_t frames = static_cast<std::size_t>(depth);
+    if (frames < path_.size()) {
+        /* Returned to the caller. */
+        path_.resize(frames);
+    } else if (frames > path_.size()) {
+        /* Called a new function. */
+        path_.push_back(Child(path_.empty() ? -1 : path_.back(), function));
+        functions_[nodes_[path_.back()].function].calls++;
+    }
+
+    if (functions_[nodes_[path_.back()].function].function != function) {
+        int parent = nodes_[path_.back()].parent;
+        path_.back() = Child(parent, function);
+    }
+    current_ = &functions_[nodes_[path_.back()].function];
+    code_    = function->chunk.GetCode().data();
+}
+
+void
+Profiler::Stop()
+{
+    Charge(Clock::now());
+    last_node_ = -1;
+    path_.clear();
+    current_ = nullptr;
+    code_    = nullptr;
+}
+
+uint64_t
+Profiler::GetInstructionCount() const
+{
+    uint64_t count = 0;
+    for (const FunctionProfile& profile : functions_) {
+        for (uint64_t executions : profile.counts)
+            count += executions;
+    }
+    return count;
+}
+
+int
+Profiler::Child(int parent, obj::ObjFunction* function)
+{
+    auto found = indices_.find(function);
+    int index;
+    if (found != indices_.end()) {
+        index = found->second;
+    } else {
+        /* The vector may move, current_ is refreshed by Enter(). */
+        std::size_t size = function->chunk.GetCode().size();
+        index = static_cast<int>(functions_.size());
+        functions_.push_back({function, 0, std::vector<uint64_t>(size),
+                              std::vector<uint64_t>(size)});
+        indices_.emplace(function, index);
+    }
+
+    std::vector<int>& siblings =
+        (parent < 0) ? roots_ : nodes_[parent].children;
+    for (int node : siblings) {
+        if (nodes_[node].function == index)
+            return node;
+    }
+
+    int node = static_cast<int>(nodes_.size());
+    nodes_.push_back({index, parent, {}, 0});
+    /* nodes_ may have moved, look the siblings up again. */
+    ((parent < 0) ? roots_ : nodes_[parent].children).push_back(node);
+    return node;
+}
+
+std::string
+Profiler::Label(int index) const
+{
+    const obj::ObjFunction* function = functions_[index].function;
+    if (!function->name)
+        return "script";
+    return std::string(function->name->Chars()) + ":" +
+           std::to_string(function->chunk.GetLine(0));
+}
+
+template <typename Pre, typename Post>
+void
+Profiler::Walk(Pre pre, Post post) const
+{
+    /* Recursion in the script makes the tree as deep as the call stack,
+       walk it with an explicit stack. */
+    std::vector<std::pair<int, std::size_t>> stack;
+    for (int root : roots_) {
+        pre(root);
+        stack.push_back({root, 0});
+        while (!stack.empty()) {
+            auto& [node, next] = stack.back();
+            if (next < nodes_[node].children.size()) {
+                int child = nodes_[node].children[next++];
+                pre(child);
+                stack.push_back({child, 0});
+            } else {
+                post(node);
+                stack.pop_back();
+            }
+        }
+    }
+}
+
+void
+Profiler::Report(std::FILE* out) const
+{
+    std::map<int, Row> opcodes;
+    std::map<int, Row> functions;
+    std::map<std::pair<int, int>, Row> lines;
+    Row total;
+    for (std::size_t i = 0; i < functions_.size(); ++i) {
+        const FunctionProfile& profile = functions_[i];
+        const Chunk& chunk = profile.function->chunk;
+        int index = static_cast<int>(i);
+        for (std::size_t offset = 0; offset < profile.counts.size();
+             ++offset) {
+            uint64_t count = profile.counts[offset];
+            uint64_t nanos = profile.nanos[offset];
+            if (!count && !nanos)
+                continue;
+
+            int line = chunk.GetLine(static_cast<int>(offset));
+            for (Row* row : {&opcodes[chunk.GetCode()[offset]],
+                             &functions[index], &lines[{index, line}],
+                             &total}) {
+                row->count += count;
+                row->nanos += nanos;
+            }
+        }
+    }
+
+    /* A function's total time includes its callees, each path is counted
+       once even if the function recurses. */
+    std::vector<uint64_t> subtree(nodes_.size());
+    for (std::size_t i = nodes_.size(); i-- > 0;) {
+        subtree[i] += nodes_[i].nanos;
+        if (nodes_[i].parent >= 0)
+            subtree[nodes_[i].parent] += subtree[i];
+    }
+    std::vector<uint64_t> inclusive(functions_.size());
+    std::vector<int> active(functions_.size());
+    Walk([&](int node) {
+             int function = nodes_[node].function;
+             if (0 == active[function]++)
+                 inclusive[function] += subtree[node];
+         },
+         [&](int node) { active[nodes_[node].function]--; });
+
+    std::fprintf(out, "profile: %llu instructions in %.3f ms\n\n",
+                 static_cast<unsigned long long>(total.count),
+                 Millis(total.nanos));
+
+    std::fprintf(out, "%-28s %14s %12s %7s\n",
+                 "opcode", "count", "self ms", "self %");
+    for (int op : SortByTime(opcodes)) {
+        const Row& row = opcodes.at(op);
+        std::fprintf(out, "%-28s %14llu %12.3f %6.2f%%\n",
+                     Chunk::GetOpCodeName(static_cast<uint8_t>(op)),
+                     static_cast<unsigned long long>(row.count),
+                     Millis(row.nanos), Percent(row.nanos, total.nanos));
+    }
+
+    std::fprintf(out, "\n%-28s %10s %14s %12s %12s\n",
+                 "function", "calls", "instructions", "self ms", "total ms");
+    std::vector<int> by_function = SortByTime(functions);
+    if (by_function.size() > kReportRows)
+        by_function.resize(kReportRows);
+    for (int index : by_function) {
+        const Row& row = functions.at(index);
+        std::fprintf(out, "%-28s %10llu %14llu %12.3f %12.3f\n",
+                     Label(index).c_str(),
+                     static_cast<unsigned long long>(functions_[index].calls),
+                     static_cast<unsigned long long>(row.count),
+                     Millis(row.nanos), Millis(inclusive[index]));
+    }
+
+    std::fprintf(out, "\n%-28s %6s %14s %12s %7s\n",
+                 "function", "line", "count", "self ms", "self %");
+    std::vector<std::pair<int, int>> by_line = SortByTime(lines);
+    if (by_line.size() > kReportRows)
+        by_line.resize(kReportRows);
+    for (const std::pair<int, int>& key : by_line) {
+        const Row& row = lines.at(key);
+        std::fprintf(out, "%-28s %6d %14llu %12.3f %6.2f%%\n",
+                     Label(key.first).c_str(), key.second,
+                     static_cast<unsigned long long>(row.count),
+                     Millis(row.nanos), Percent(row.nanos, total.nanos));
+    }
+}
+
+bool
+Profiler::WriteStacks(const std::string& path) const
+{
+    std::FILE* file = std::fopen(path.c_str(), "w");
+    if (!file) {
+        std::fprintf(stderr, "error: unable to write '%s'\n", path.c_str());
+        return false;
+    }
+
+    std::string stack;
+    std::vector<std::size_t> lengths;
+    Walk([&](int node) {
+             lengths.push_back(stack.size());
+             if (!stack.empty())
+                 stack += ';';
+             stack += Label(nodes_[node].function);
+             if (nodes_[node].nanos) {
+                 std::fprintf(file, "%s %llu\n", stack.c_str(),
+                              static_cast<unsigned long long>(
+                                  nodes_[node].nanos));
+             }
+         },
+         [&]([[maybe_unused]] int node) {
+             stack.resize(lengths.back());
+             lengths.pop_back();
+         });
+
+    bool ok = !std::ferror(file);
+    if ((0 != std::fclose(file)) || !ok) {
+        std::fprintf(stderr, "error: unable to write '%s'\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void
+Profiler::MarkRoots(obj::Heap& heap) const
+{
+    for (const FunctionProfile& profile : functions_)
+        heap.MarkObject(profile.function);
+}
+} // end vm
+} // end lox
@@ -7,33 +7,11 @@ namespace lox
 {
 namespace vm
 {
-struct ValueStack vm_stack;
-
-void
-ResetStack() { vm_stack.stack_top = vm_stack.stack; }
-
-void
-Push(const val::Value& value)
-{
-    *vm_stack.stack_top = value;
-    vm_stack.stack_top++;
-}
-
-val::Value
-Pop()
-{
-    vm_stack.stack_top--;
-    return *vm_stack.stack_top;
-}
-
-val::Value
-Peek(int distance) { return vm_stack.stack_top[-1 - distance]; }
-
 void
-PrintStack()
+ValueStack::Print() const
 {
     std::cout << "          ";
-    for (val::Value* slot = vm_stack.stack; slot < vm_stack.stack_top; slot++)
+    for (const val::Value* slot = values_.get(); slot < top_; slot++)
     {
         std::cout << "[ ";
         val::PrintValue(*slot);
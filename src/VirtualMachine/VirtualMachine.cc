@@ -1,18 +1,27 @@
 #include <ctime>
+#include <algorithm>
 #include <cstdio>
 #include <cstdarg>
 #include <cstdint>
+#include <cstring>
 #include <memory>
+#include <string>
+#include <string_view>
 
 #include "Chunk.h"
 #include "Value.h"
 #include "Object.h"
+#include "Heap.h"
+#include "Image.h"
 #include "VirtualMachine.h"
 
 namespace lox
 {
 namespace vm
 {
+static constexpr int kMaxTraceFrames =
+    64; /*!< Stack trace lines printed by a runtime error. */
+
 static val::Value
 ClockNative(
     [[maybe_unused]]int arg_count,
@@ -30,23 +39,35 @@ VirtualMachine::RuntimeError(const char* format, ...)
     va_end(args);
     std::fputs("\n", stderr);
 
+    /* Deep recursion would flood STDERR, only the innermost and outermost
+       frames of a long trace are printed. */
+    int elided = std::max(frame_count - kMaxTraceFrames, 0);
     for (int i = frame_count - 1; i >= 0; --i) {
+        if (elided && (i == (kMaxTraceFrames / 2) + elided - 1)) {
+            std::fprintf(stderr, "[... %d more frames ...]\n", elided);
+            i -= elided - 1;
+            continue;
+        }
+
         CallFrame* frame = &frames_[i];
-        std::shared_ptr<obj::ObjFunction> function = frame->closure->function;
-        std::size_t instruction = frame->ip - 1;
+        obj::ObjFunction* function = frame->closure->function;
+        std::size_t instruction =
+            frame->ip - function->chunk.GetCode().data() - 1;
 
         std::fprintf(stderr, "[line %d] in ",
-                     function->chunk.GetLines()[instruction]);
+                     function->chunk.GetLine(static_cast<int>(instruction)));
         if (!function->name)
             std::fprintf(stderr, "script\n");
         else
-            std::fprintf(stderr, "%s()\n", function->name->chars.c_str());
+            std::fprintf(stderr, "%s()\n", function->name->Chars());
     }
-    ResetStack();
+    stack_.Reset();
+    frame_count    = 0;
+    open_upvalues_ = nullptr;
 }
 
 bool
-VirtualMachine::Call(std::shared_ptr<obj::ObjClosure> closure, int arg_count)
+VirtualMachine::Call(obj::ObjClosure* closure, int arg_count)
 {
     if (arg_count != closure->function->arity) {
         RuntimeError("Expected %d arguments but got %d.",
@@ -54,19 +75,38 @@ VirtualMachine::Call(std::shared_ptr<obj::ObjClosure> closure, int arg_count)
         return false;
     }
 
-    if (frame_count == kFramesMax) {
+    if (static_cast<std::size_t>(frame_count) == max_frames_) {
         RuntimeError("Stack overflow.");
         return false;
     }
 
+    /* The callee and its arguments are already on the stack. */
+    EnsureStack(closure->function->max_slots - arg_count - 1);
+    if (static_cast<std::size_t>(frame_count) == frames_.size())
+        frames_.emplace_back();
+
     CallFrame* frame = &frames_[frame_count++];
     frame->closure = closure;
-    frame->ip      = 0;
-    frame->slots   = vm_stack.stack_top - arg_count - 1;
+    frame->ip      = closure->function->chunk.GetCode().data();
+    frame->slots   = stack_.Top() - arg_count - 1;
 
     return true;
 }
 
+void
+VirtualMachine::EnsureStack(std::size_t count)
+{
+    stack_.Reserve(count, [this](val::Value* old_base, val::Value* new_base) {
+        for (int i = 0; i < frame_count; ++i)
+            frames_[i].slots = new_base + (frames_[i].slots - old_base);
+
+        for (UpvaluePtr upvalue = open_upvalues_; upvalue;
+             upvalue = upvalue->next) {
+            upvalue->location = new_base + (upvalue->location - old_base);
+        }
+    });
+}
+
 bool
 VirtualMachine::CallValue(const val::Value& callee, int arg_count)
 {
@@ -76,22 +116,22 @@ VirtualMachine::CallValue(const val::Value& callee, int arg_count)
                 return Call(obj::AsClosure(callee), arg_count);
                 break;
             case obj::ObjType::kObjNative: {
-                obj::NativeFn native = obj::AsNative(callee);
+                const obj::NativeFn& native = obj::AsNative(callee);
                 val::Value result = native(arg_count,
-                                           vm_stack.stack_top - arg_count);
-                vm_stack.stack_top -= arg_count + 1;
-                Push(result);
+                                           stack_.Top() - arg_count);
+                stack_.SetTop(stack_.Top() - arg_count - 1);
+                stack_.Push(result);
                 return true;
                 break;
             }
             case obj::ObjType::kObjClass: {
-                std::shared_ptr<obj::ObjClass> klass = obj::AsClass(callee);
-                vm_stack.stack_top[-arg_count - 1] =
-                    obj::ObjVal(obj::NewInstance(klass));
+                obj::ObjClass* klass = obj::AsClass(callee);
+                stack_.Top()[-arg_count - 1] =
+                    obj::ObjVal(obj::NewInstance(heap_, klass));
 
-                if (klass->methods.find(init_string_) != klass->methods.end()) {
-                    return Call(obj::AsClosure(klass->methods[init_string_]),
-                                arg_count);
+                val::Value initializer;
+                if (klass->methods.Get(init_string_, &initializer)) {
+                    return Call(obj::AsClosure(initializer), arg_count);
                 } else if (arg_count != 0) {
                     RuntimeError("Expected 0 arguments but got %d.",
                                  arg_count);
@@ -101,9 +141,15 @@ VirtualMachine::CallValue(const val::Value& callee, int arg_count)
                 break;
             }
             case obj::ObjType::kObjBoundMethod: {
-                std::shared_ptr<obj::ObjBoundMethod> bound =
-                    obj::AsBoundMethod(callee);
-                vm_stack.stack_top[-arg_count - 1] = bound->receiver;
+                obj::ObjBoundMethod* bound = obj::AsBoundMethod(callee);
+                stack_.Top()[-arg_count - 1] = bound->receiver;
+                if (bound->transient) {
+                    /* Nothing refers to it once called, keep it for the
+                       next kOpGetMethod. */
+                    bound->transient = false;
+                    bound->receiver  = val::NilVal();
+                    spare_bound_methods_.push_back(bound);
+                }
                 return Call(bound->method, arg_count);
             }
             default:
@@ -115,91 +161,147 @@ VirtualMachine::CallValue(const val::Value& callee, int arg_count)
     return false;
 }
 
-uint16_t
-VirtualMachine::ReadShort(CallFrame* frame)
+bool
+VirtualMachine::StringsEqual(const val::Value& a, const val::Value& b)
 {
-    frame->ip += 2;
-    return ((frame->closure->function->chunk.GetInstruction(frame->ip - 2) << 8) |
-             frame->closure->function->chunk.GetInstruction(frame->ip - 1));
+    if (!obj::IsString(a) || !obj::IsString(b))
+        return false;
+
+    /* Distinct flat strings differ since they are interned. */
+    LoxString string_a = obj::AsString(a);
+    LoxString string_b = obj::AsString(b);
+    if ((string_a->length != string_b->length) ||
+        (!obj::IsRope(string_a) && !obj::IsRope(string_b)))
+        return false;
+
+    LoxString flat_a = obj::FlattenString(heap_, string_a);
+    return (flat_a == obj::FlattenString(heap_, string_b));
 }
 
 void
 VirtualMachine::Concatenate()
 {
-    LoxString b = obj::AsString(Pop());
-    LoxString a = obj::AsString(Pop());
+    /* Leave the operands on the stack while allocating the result so they
+       stay reachable should the allocation trigger a GC. */
+    LoxString b = obj::AsString(stack_.Peek(0));
+    LoxString a = obj::AsString(stack_.Peek(1));
 
-    LoxString result = std::make_shared<obj::ObjString>();
-    result->type  = obj::ObjType::kObjString;
-    result->chars = a->chars + b->chars;
-    Push(ObjVal(result));
+    /* Short results are built flat, ropes are never shorter than
+       kMinRopeLength so both operands are flat then. */
+    LoxString result;
+    std::size_t length = a->length + b->length;
+    if (length < obj::kMinRopeLength) {
+        char chars[obj::kMinRopeLength];
+        std::memcpy(chars, a->Chars(), a->length);
+        std::memcpy(chars + a->length, b->Chars(), b->length);
+        result = obj::CopyString(heap_, std::string_view(chars, length));
+    } else {
+        result = obj::NewRope(heap_, a, b);
+    }
+
+    stack_.Pop();
+    stack_.Pop();
+    stack_.Push(ObjVal(result));
 }
 
 void
 VirtualMachine::DefineNative(const std::string& name, obj::NativeFn function)
 {
-    Push(obj::ObjVal(obj::CopyString(name, interned_strs_)));
-    Push(obj::ObjVal(obj::NewNative(function)));
-    globals_[obj::AsString(vm_stack.stack[0])] = vm_stack.stack[1];
-    Pop();
-    Pop();
+    EnsureStack(2);
+    stack_.Push(obj::ObjVal(obj::CopyString(heap_, name)));
+    stack_.Push(obj::ObjVal(obj::NewNative(heap_, function)));
+    globals_.Set(globals_.Resolve(obj::AsString(stack_.Base()[0])),
+                 stack_.Base()[1]);
+    stack_.Pop();
+    stack_.Pop();
 }
 
 void
 VirtualMachine::DefineMethod(LoxString name)
 {
-    val::Value method = Peek(0);
-    std::shared_ptr<obj::ObjClass> klass = obj::AsClass(Peek(1));
-    klass->methods[name] = method;
-    Pop();
+    val::Value method = stack_.Peek(0);
+    obj::ObjClass* klass = obj::AsClass(stack_.Peek(1));
+    klass->methods.Set(name, method);
+    stack_.Pop();
 }
 
 bool
 VirtualMachine::BindMethod(
-    std::shared_ptr<obj::ObjClass> klass,
-    LoxString name)
+    obj::ObjClass* klass,
+    LoxString name,
+    bool transient)
 {
-    if (klass->methods.find(name) == klass->methods.end()) {
-        RuntimeError("Undefined property '%s'.", name->chars.c_str());
+    val::Value method;
+    if (!klass->methods.Get(name, &method)) {
+        RuntimeError("Undefined property '%s'.", name->Chars());
         return false;
     }
 
-    std::shared_ptr<obj::ObjBoundMethod> bound =
-        obj::NewBoundMethod(Peek(0), obj::AsClosure(klass->methods[name]));
+    obj::ObjBoundMethod* bound = nullptr;
+    if (transient && !spare_bound_methods_.empty()) {
+        bound = spare_bound_methods_.back();
+        spare_bound_methods_.pop_back();
+        bound->receiver = stack_.Peek(0);
+        bound->method   = obj::AsClosure(method);
+    } else {
+        bound = obj::NewBoundMethod(heap_, stack_.Peek(0),
+                                    obj::AsClosure(method));
+    }
+    bound->transient = transient;
 
-    Pop();
-    Push(obj::ObjVal(bound));
+    stack_.Pop();
+    stack_.Push(obj::ObjVal(bound));
     return true;
 }
 
 bool
 VirtualMachine::InvokeFromClass(
-    std::shared_ptr<obj::ObjClass> klass,
+    obj::ObjClass* klass,
     LoxString name,
     int arg_count)
 {
-    if (klass->methods.find(name) == klass->methods.end()) {
-        RuntimeError("Undefined property '%s'.", name->chars.c_str());
+    val::Value method;
+    if (!klass->methods.Get(name, &method)) {
+        RuntimeError("Undefined property '%s'.", name->Chars());
         return false;
     }
-    return Call(obj::AsClosure(klass->methods[name]), arg_count);
+    return Call(obj::AsClosure(method), arg_count);
 }
 
 bool
-VirtualMachine::Invoke(LoxString name, int arg_count)
+VirtualMachine::Invoke(
+    LoxString name,
+    int arg_count,
+    Chunk::InlineCache& cache)
 {
-    val::Value receiver = Peek(arg_count);
+    val::Value receiver = stack_.Peek(arg_count);
     if (!obj::IsInstance(receiver)) {
         RuntimeError("Only instances have methods.");
         return false;
     }
 
-    std::shared_ptr<obj::ObjInstance> instance = obj::AsInstance(receiver);
-    if (instance->fields.find(name) != instance->fields.end()) {
-        vm_stack.stack_top[-arg_count - 1] = instance->fields[name];
-        return CallValue(instance->fields[name], arg_count);
+    /* The shape guarantees there is still no field shadowing the method. */
+    obj::ObjInstance* instance = obj::AsInstance(receiver);
+    if ((cache.shape == instance->shape) && (cache.klass == instance->klass))
+        return Call(cache.method, arg_count);
+
+    int slot = instance->shape->Lookup(name);
+    if (slot >= 0) {
+        val::Value value = instance->fields[slot];
+        stack_.Top()[-arg_count - 1] = value;
+        return CallValue(value, arg_count);
+    }
+
+    val::Value method;
+    if (!instance->klass->methods.Get(name, &method)) {
+        RuntimeError("Undefined property '%s'.", name->Chars());
+        return false;
     }
-    return InvokeFromClass(instance->klass, name, arg_count);
+
+    cache.shape  = instance->shape;
+    cache.klass  = instance->klass;
+    cache.method = obj::AsClosure(method);
+    return Call(cache.method, arg_count);
 }
 
 void
@@ -213,7 +315,7 @@ VirtualMachine::CloseUpvalues(val::Value* last)
     }
 }
 
-std::shared_ptr<obj::ObjUpvalue>
+VirtualMachine::UpvaluePtr
 VirtualMachine::CaptureUpvalue(val::Value* local)
 {
     UpvaluePtr prev_upvalue = nullptr;
@@ -226,7 +328,7 @@ VirtualMachine::CaptureUpvalue(val::Value* local)
     if (upvalue && (upvalue->location == local))
         return upvalue;
 
-    UpvaluePtr created_upvalue = obj::NewUpvalue(local);
+    UpvaluePtr created_upvalue = obj::NewUpvalue(heap_, local);
     created_upvalue->next = upvalue;
     if (!prev_upvalue)
         open_upvalues_ = created_upvalue;
@@ -236,168 +338,404 @@ VirtualMachine::CaptureUpvalue(val::Value* local)
     return created_upvalue;
 }
 
+template <bool kProfile>
 VirtualMachine::InterpretResult
 VirtualMachine::Run()
 {
-    CallFrame* frame = &frames_[frame_count - 1];
+    /* The decoding state of the active frame lives in locals so the
+       compiler can keep it in registers. frame->ip is only brought up to
+       date when control may leave this frame: on calls, returns and
+       whenever a runtime error is about to walk the frame stack. */
+    CallFrame*        frame     = nullptr;
+    const uint8_t*    ip        = nullptr;
+    const val::Value* constants = nullptr;
+    Chunk::InlineCache* caches  = nullptr;
+    uint8_t instruction = 0;
+    /* Index operand shared by the short and Long forms of an instruction:
+       the Long handler reads 24 bits and jumps into the short handler's
+       body past its own operand read. */
+    uint32_t operand = 0;
+
+#define VM_LOAD_FRAME()                                             \
+    do {                                                            \
+        frame     = &frames_[frame_count - 1];                      \
+        ip        = frame->ip;                                      \
+        constants =                                                 \
+            frame->closure->function->chunk.GetConstants().data();  \
+        caches =                                                    \
+            frame->closure->function->chunk.GetInlineCaches().data(); \
+        if constexpr (kProfile)                                     \
+            profiler_->Enter(frame->closure->function, frame_count); \
+    } while (0)
+#define VM_STORE_FRAME()   (frame->ip = ip)
+#define VM_READ_BYTE()     (*ip++)
+#define VM_READ_SHORT()                                             \
+    (ip += 2, static_cast<uint16_t>((ip[-2] << 8) | ip[-1]))
+#define VM_READ_LONG()                                              \
+    (ip += 3, static_cast<uint32_t>(                                \
+        (ip[-3] << 16) | (ip[-2] << 8) | ip[-1]))
+#define VM_OPERAND_STRING() obj::AsString(constants[operand])
+#define VM_RUNTIME_ERROR(...)                                       \
+    do {                                                            \
+        VM_STORE_FRAME();                                           \
+        RuntimeError(__VA_ARGS__);                                  \
+        return InterpretResult::kInterpretRuntimeError;             \
+    } while (0)
 
-    while (true) {
 #ifdef DEBUG_TRACE_EXECUTION
-        PrintStack();
-        frame->closure->function->chunk.Disassemble(frame->ip);
+#define VM_TRACE()                                                  \
+    do {                                                            \
+        stack_.Print();                                               \
+        frame->closure->function->chunk.Disassemble(static_cast<int>( \
+            ip - frame->closure->function->chunk.GetCode().data()));  \
+    } while (0)
+#else
+#define VM_TRACE() do {} while (0)
 #endif
-        uint8_t instruction = ReadByte(frame);
+
+#define VM_PROFILE()                                                \
+    do {                                                            \
+        if constexpr (kProfile)                                     \
+            profiler_->Step(ip);                                    \
+    } while (0)
+
+#ifdef COMPUTED_GOTO
+    /* Direct threading: every handler ends with its own indirect jump to
+       the next handler which gives the branch predictor one jump site per
+       opcode instead of a single shared one. The table must list a label
+       for every Chunk::OpCode in declaration order. */
+    static void* const kDispatchTable[] = {
+        &&L_kOpConstant,
+        &&L_kOpReturn,
+        &&L_kOpNil,
+        &&L_kOpTrue,
+        &&L_kOpFalse,
+        &&L_KOpEqual,
+        &&L_kOpNotEqual,
+        &&L_kOpGreater,
+        &&L_kOpGreaterEqual,
+        &&L_kOpLess,
+        &&L_kOpLessEqual,
+        &&L_kOpNot,
+        &&L_kOpNegate,
+        &&L_kOpAdd,
+        &&L_kOpSubtract,
+        &&L_kOpMultiply,
+        &&L_kOpDivide,
+        &&L_kOpPrint,
+        &&L_kOpPop,
+        &&L_kOpDefineGlobal,
+        &&L_kOpGetGlobal,
+        &&L_kOpSetGlobal,
+        &&L_kOpGetLocal,
+        &&L_kOpSetLocal,
+        &&L_kOpJumpIfFalse,
+        &&L_kOpJump,
+        &&L_kOpLoop,
+        &&L_kOpCall,
+        &&L_kOpClosure,
+        &&L_kOpGetUpvalue,
+        &&L_kOpSetUpvalue,
+        &&L_kOpCloseUpvalue,
+        &&L_kOpClass,
+        &&L_kOpSetProperty,
+        &&L_kOpGetProperty,
+        &&L_kOpMethod,
+        &&L_kOpInvoke,
+        &&L_kOpInherit,
+        &&L_kOpGetSuper,
+        &&L_kOpSuperInvoke,
+        &&L_kOpConstantLong,
+        &&L_kOpDefineGlobalLong,
+        &&L_kOpGetGlobalLong,
+        &&L_kOpSetGlobalLong,
+        &&L_kOpGetLocalLong,
+        &&L_kOpSetLocalLong,
+        &&L_kOpClosureLong,
+        &&L_kOpClassLong,
+        &&L_kOpSetPropertyLong,
+        &&L_kOpGetPropertyLong,
+        &&L_kOpMethodLong,
+        &&L_kOpInvokeLong,
+        &&L_kOpGetSuperLong,
+        &&L_kOpSuperInvokeLong,
+        &&L_kOpGetMethod,
+        &&L_kOpGetMethodLong,
+        &&L_kOpJumpIfTrue,
+        &&L_kOpGetLocalGetLocal,
+        &&L_kOpGetLocalConstantAdd,
+        &&L_kOpGetLocalGetProperty,
+        &&L_kOpLessJumpIfFalse
+    };
+    static_assert(sizeof(kDispatchTable) / sizeof(kDispatchTable[0]) ==
+                  Chunk::OpCode::kOpLessJumpIfFalse + 1,
+                  "Dispatch table is out of sync with Chunk::OpCode.");
+
+#define VM_DISPATCH()                                               \
+    do {                                                            \
+        VM_TRACE();                                                 \
+        VM_PROFILE();                                               \
+        instruction = VM_READ_BYTE();                               \
+        goto *kDispatchTable[instruction];                          \
+    } while (0)
+#define VM_CASE(op) L_##op
+#define VM_BREAK    VM_DISPATCH()
+
+    VM_LOAD_FRAME();
+    VM_DISPATCH();
+#else
+#define VM_CASE(op) case Chunk::OpCode::op
+#define VM_BREAK    break
+
+    VM_LOAD_FRAME();
+    while (true) {
+        VM_TRACE();
+        VM_PROFILE();
+        instruction = VM_READ_BYTE();
         switch (instruction) {
-            case Chunk::OpCode::kOpConstant:
-                Push(ReadConstant(frame));
-                break;
-            case Chunk::OpCode::kOpNil:
-                Push(val::NilVal());
-                break;
-            case Chunk::OpCode::kOpTrue:
-                Push(val::BoolVal(true));
-                break;
-            case Chunk::OpCode::kOpFalse:
-                Push(val::BoolVal(false));
-                break;
-            case Chunk::OpCode::KOpEqual: {
-                val::Value b = Pop();
-                val::Value a = Pop();
-                Push(val::BoolVal(val::ValuesEqual(a, b)));
-                break;
+#endif
+            VM_CASE(kOpConstantLong):
+                operand = VM_READ_LONG();
+                goto constant;
+            VM_CASE(kOpConstant):
+                operand = VM_READ_BYTE();
+            constant:
+                stack_.Push(constants[operand]);
+                VM_BREAK;
+            VM_CASE(kOpNil):
+                stack_.Push(val::NilVal());
+                VM_BREAK;
+            VM_CASE(kOpTrue):
+                stack_.Push(val::BoolVal(true));
+                VM_BREAK;
+            VM_CASE(kOpFalse):
+                stack_.Push(val::BoolVal(false));
+                VM_BREAK;
+            VM_CASE(KOpEqual): {
+                /* The operands stay on the stack while ValuesEqual() may
+                   flatten them. */
+                val::Value* top = stack_.Top();
+                top[-2] = val::BoolVal(ValuesEqual(top[-2], top[-1]));
+                stack_.SetTop(top - 1);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpGreater:
-            case Chunk::OpCode::kOpLess:
-                BinaryOp<bool>(val::BoolVal,
-                               static_cast<Chunk::OpCode>(instruction));
-                break;
-            case Chunk::OpCode::kOpNot: {
-                bool is_falsey = IsFalsey(Pop());
-                Push(val::BoolVal(is_falsey));
-                break;
+            VM_CASE(kOpNotEqual): {
+                val::Value* top = stack_.Top();
+                top[-2] = val::BoolVal(!ValuesEqual(top[-2], top[-1]));
+                stack_.SetTop(top - 1);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpNegate: {
-                val::Value val = Peek(0);
+            VM_CASE(kOpGreater):
+                if (!BinaryOp([](double a, double b)
+                              { return val::BoolVal(a > b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpGreaterEqual):
+                if (!BinaryOp([](double a, double b)
+                              { return val::BoolVal(a >= b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpLess):
+                if (!BinaryOp([](double a, double b)
+                              { return val::BoolVal(a < b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpLessEqual):
+                if (!BinaryOp([](double a, double b)
+                              { return val::BoolVal(a <= b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpNot): {
+                bool is_falsey = IsFalsey(stack_.Pop());
+                stack_.Push(val::BoolVal(is_falsey));
+                VM_BREAK;
+            }
+            VM_CASE(kOpNegate): {
+                val::Value val = stack_.Peek(0);
                 if (!val::IsNumber(val)) {
-                    RuntimeError("Operand must be a number.");
-                    return InterpretResult::kInterpretRuntimeError;
+                    VM_RUNTIME_ERROR("Operand must be a number.");
                 }
-                Pop();
-                Push(val::NumberVal(-val::AsNumber(val)));
-                break;
+                stack_.Pop();
+                stack_.Push(val::NumberVal(-val::AsNumber(val)));
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpAdd: {
-                val::Value b = Peek(0);
-                val::Value a = Peek(1);
-                if (obj::IsString(a) && obj::IsString(b)) {
+            VM_CASE(kOpAdd):
+            add: {
+                /* Numbers first: arithmetic is far more common than string
+                   concatenation. */
+                if (BinaryOp([](double a, double b)
+                             { return val::NumberVal(a + b); }))
+                    VM_BREAK;
+
+                if (obj::IsString(stack_.Peek(0)) && obj::IsString(stack_.Peek(1))) {
                     Concatenate();
-                } else if (val::IsNumber(a) && val::IsNumber(b)) {
-                    BinaryOp<double>(val::NumberVal,
-                                     static_cast<Chunk::OpCode>(instruction));
                 } else {
-                    RuntimeError(
+                    VM_RUNTIME_ERROR(
                         "Operands must be two numbers or two strings.");
-                    return InterpretResult::kInterpretRuntimeError;
                 }
-                break;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSubtract:
-            case Chunk::OpCode::kOpMultiply:
-            case Chunk::OpCode::kOpDivide:
-                BinaryOp<double>(val::NumberVal,
-                                 static_cast<Chunk::OpCode>(instruction));
-                break;
-            case Chunk::OpCode::kOpPrint:
-                PrintValue(Pop());
+            VM_CASE(kOpSubtract):
+                if (!BinaryOp([](double a, double b)
+                              { return val::NumberVal(a - b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpMultiply):
+                if (!BinaryOp([](double a, double b)
+                              { return val::NumberVal(a * b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpDivide):
+                if (!BinaryOp([](double a, double b)
+                              { return val::NumberVal(a / b); }))
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                VM_BREAK;
+            VM_CASE(kOpPrint):
+                PrintValue(stack_.Pop());
                 std::printf("\n");
-                break;
-            case Chunk::OpCode::kOpPop:
-                Pop();
-                break;
-            case Chunk::OpCode::kOpDefineGlobal: {
-                LoxString name = obj::AsString(ReadConstant(frame));
-                globals_[name] = Pop();
-                break;
-            }
-            case Chunk::OpCode::kOpGetGlobal: {
-                LoxString name = obj::AsString(ReadConstant(frame));
-                if (globals_.find(name) == globals_.end()) {
-                    RuntimeError(
+                VM_BREAK;
+            VM_CASE(kOpPop):
+                stack_.Pop();
+                VM_BREAK;
+            VM_CASE(kOpDefineGlobalLong):
+                operand = VM_READ_LONG();
+                goto define_global;
+            VM_CASE(kOpDefineGlobal):
+                operand = VM_READ_SHORT();
+            define_global:
+                globals_.Set(operand, stack_.Peek(0));
+                stack_.Pop();
+                VM_BREAK;
+            VM_CASE(kOpGetGlobalLong):
+                operand = VM_READ_LONG();
+                goto get_global;
+            VM_CASE(kOpGetGlobal):
+                operand = VM_READ_SHORT();
+            get_global: {
+                const val::Value& value = globals_.Get(operand);
+                if (val::IsUndefined(value)) {
+                    VM_RUNTIME_ERROR(
                         "Undefined variable '%s'.",
-                        name->chars.c_str());
-                    return InterpretResult::kInterpretRuntimeError;
+                        globals_.Name(operand)->Chars());
                 }
-                Push(globals_[name]);
-                break;
+                stack_.Push(value);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSetGlobal: {
-                LoxString name = obj::AsString(ReadConstant(frame));
-                if (globals_.find(name) == globals_.end()) {
-                    RuntimeError(
+            VM_CASE(kOpSetGlobalLong):
+                operand = VM_READ_LONG();
+                goto set_global;
+            VM_CASE(kOpSetGlobal):
+                operand = VM_READ_SHORT();
+            set_global:
+                if (val::IsUndefined(globals_.Get(operand))) {
+                    VM_RUNTIME_ERROR(
                         "Undefined variable '%s'.",
-                        name->chars.c_str());
-                    return InterpretResult::kInterpretRuntimeError;
+                        globals_.Name(operand)->Chars());
                 }
-                globals_[name] = Peek(0);
-                break;
+                globals_.Set(operand, stack_.Peek(0));
+                VM_BREAK;
+            VM_CASE(kOpGetLocalLong):
+                operand = VM_READ_LONG();
+                goto get_local;
+            VM_CASE(kOpGetLocal):
+                operand = VM_READ_BYTE();
+            get_local:
+                stack_.Push(frame->slots[operand]);
+                VM_BREAK;
+            VM_CASE(kOpSetLocalLong):
+                operand = VM_READ_LONG();
+                goto set_local;
+            VM_CASE(kOpSetLocal):
+                operand = VM_READ_BYTE();
+            set_local:
+                frame->slots[operand] = stack_.Peek(0);
+                VM_BREAK;
+            VM_CASE(kOpJumpIfFalse): {
+                uint16_t offset = VM_READ_SHORT();
+                if (IsFalsey(stack_.Peek(0)))
+                    ip += offset;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpGetLocal: {
-                uint8_t slot = ReadByte(frame);
-                Push(frame->slots[slot]);
-                break;
+            VM_CASE(kOpJumpIfTrue): {
+                uint16_t offset = VM_READ_SHORT();
+                if (!IsFalsey(stack_.Peek(0)))
+                    ip += offset;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSetLocal: {
-                uint8_t slot = ReadByte(frame);
-                frame->slots[slot] = Peek(0);
-                break;
+            VM_CASE(kOpJump): {
+                uint16_t offset = VM_READ_SHORT();
+                ip += offset;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpJumpIfFalse: {
-                uint16_t offset = ReadShort(frame);
-                if (IsFalsey(Peek(0)))
-                    frame->ip += offset;
-                break;
+            VM_CASE(kOpGetLocalGetLocal):
+                stack_.Push(frame->slots[VM_READ_BYTE()]);
+                stack_.Push(frame->slots[VM_READ_BYTE()]);
+                VM_BREAK;
+            VM_CASE(kOpGetLocalConstantAdd): {
+                val::Value a = frame->slots[VM_READ_BYTE()];
+                val::Value b = constants[VM_READ_BYTE()];
+                if (val::IsNumber(a) && val::IsNumber(b)) {
+                    stack_.Push(val::NumberVal(val::AsNumber(a) +
+                                               val::AsNumber(b)));
+                    VM_BREAK;
+                }
+                stack_.Push(a);
+                stack_.Push(b);
+                goto add;
             }
-            case Chunk::OpCode::kOpJump: {
-                uint16_t offset = ReadShort(frame);
-                frame->ip += offset;
-                break;
+            VM_CASE(kOpLessJumpIfFalse): {
+                val::Value* top = stack_.Top();
+                if (!val::IsNumber(top[-2]) || !val::IsNumber(top[-1])) {
+                    VM_RUNTIME_ERROR("Operands must be numbers.");
+                }
+                bool less = val::AsNumber(top[-2]) < val::AsNumber(top[-1]);
+                stack_.SetTop(top - 2);
+                uint16_t offset = VM_READ_SHORT();
+                if (!less)
+                    ip += offset;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpLoop: {
-                uint16_t offset = ReadShort(frame);
-                frame->ip -= offset;
-                break;
+            VM_CASE(kOpLoop): {
+                uint16_t offset = VM_READ_SHORT();
+                ip -= offset;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpCall: {
-                int arg_count = ReadByte(frame);
-                if (!CallValue(Peek(arg_count), arg_count))
+            VM_CASE(kOpCall): {
+                int arg_count = VM_READ_BYTE();
+                VM_STORE_FRAME();
+                if (!CallValue(stack_.Peek(arg_count), arg_count))
                     return InterpretResult::kInterpretRuntimeError;
 
-                frame = &frames_[frame_count - 1];
-                break;
+                VM_LOAD_FRAME();
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpReturn: {
-                val::Value result = Pop();
+            VM_CASE(kOpReturn): {
+                val::Value result = stack_.Pop();
                 CloseUpvalues(frame->slots);
                 frame_count--;
                 if (0 == frame_count) {
-                    Pop();
+                    stack_.Pop();
                     return InterpretResult::kInterpretOk;
                 }
 
-                vm_stack.stack_top = frame->slots;
-                Push(result);
-                frame = &frames_[frame_count - 1];
-                break;
+                stack_.SetTop(frame->slots);
+                stack_.Push(result);
+                VM_LOAD_FRAME();
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpClosure: {
-                std::shared_ptr<obj::ObjFunction> function =
-                    obj::AsFunction(ReadConstant(frame));
-                std::shared_ptr<obj::ObjClosure> closure =
-                    obj::NewClosure(function);
-                Push(obj::ObjVal(closure));
+            VM_CASE(kOpClosureLong):
+                operand = VM_READ_LONG();
+                goto closure;
+            VM_CASE(kOpClosure):
+                operand = VM_READ_BYTE();
+            closure: {
+                obj::ObjFunction* function =
+                    obj::AsFunction(constants[operand]);
+                obj::ObjClosure* closure = obj::NewClosure(heap_, function);
+                stack_.Push(obj::ObjVal(closure));
                 for (int i = 0; i < closure->upvalue_count; ++i) {
-                    uint8_t is_local = ReadByte(frame);
-                    uint8_t index    = ReadByte(frame);
+                    uint8_t  is_local = VM_READ_BYTE();
+                    uint32_t index    = VM_READ_LONG();
                     if (is_local) {
                         closure->upvalues[i] =
                             CaptureUpvalue(frame->slots + index);
@@ -405,122 +743,249 @@ VirtualMachine::Run()
                         closure->upvalues[i] = frame->closure->upvalues[index];
                     }
                 }
-                break;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpGetUpvalue: {
-                uint8_t slot = ReadByte(frame);
-                Push(*frame->closure->upvalues[slot]->location);
-                break;
+            VM_CASE(kOpGetUpvalue): {
+                uint8_t slot = VM_READ_BYTE();
+                stack_.Push(*frame->closure->upvalues[slot]->location);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSetUpvalue: {
-                uint8_t slot = ReadByte(frame);
-                *frame->closure->upvalues[slot]->location = Peek(0);
-                break;
+            VM_CASE(kOpSetUpvalue): {
+                uint8_t slot = VM_READ_BYTE();
+                *frame->closure->upvalues[slot]->location = stack_.Peek(0);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpCloseUpvalue: {
-                CloseUpvalues(vm_stack.stack_top - 1);
-                Pop();
-                break;
+            VM_CASE(kOpCloseUpvalue): {
+                CloseUpvalues(stack_.Top() - 1);
+                stack_.Pop();
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpClass: {
-                LoxString klass_name = ReadString(frame);
-                Push(obj::ObjVal(obj::NewClass(klass_name)));
-                break;
-            }
-            case Chunk::OpCode::kOpGetProperty: {
-                if (!obj::IsInstance(Peek(0))) {
-                    RuntimeError("Only instances have properties.");
-                    return InterpretResult::kInterpretRuntimeError;
+            VM_CASE(kOpClassLong):
+                operand = VM_READ_LONG();
+                goto klass;
+            VM_CASE(kOpClass):
+                operand = VM_READ_BYTE();
+            klass:
+                stack_.Push(obj::ObjVal(obj::NewClass(heap_, VM_OPERAND_STRING())));
+                VM_BREAK;
+            VM_CASE(kOpGetPropertyLong):
+            VM_CASE(kOpGetMethodLong):
+                operand = VM_READ_LONG();
+                goto get_property;
+            VM_CASE(kOpGetLocalGetProperty):
+                stack_.Push(frame->slots[VM_READ_BYTE()]);
+                operand = VM_READ_BYTE();
+                goto get_property;
+            VM_CASE(kOpGetProperty):
+            VM_CASE(kOpGetMethod):
+                operand = VM_READ_BYTE();
+            get_property: {
+                if (!obj::IsInstance(stack_.Peek(0))) {
+                    VM_RUNTIME_ERROR("Only instances have properties.");
+                }
+
+                obj::ObjInstance* instance = obj::AsInstance(stack_.Peek(0));
+                LoxString name = VM_OPERAND_STRING();
+                Chunk::InlineCache& cache = caches[VM_READ_SHORT()];
+                if (cache.shape == instance->shape) {
+                    stack_.Top()[-1] = instance->fields[cache.slot];
+                    VM_BREAK;
                 }
 
-                std::shared_ptr<obj::ObjInstance> instance =
-                    obj::AsInstance(Peek(0));
-                LoxString name =
-                    ReadString(frame);
-                if (instance->fields.find(name) != instance->fields.end()) {
-                    Pop();
-                    Push(instance->fields[name]);
-                    break;
+                int slot = instance->shape->Lookup(name);
+                if (slot >= 0) {
+                    cache.shape = instance->shape;
+                    cache.slot  = static_cast<uint32_t>(slot);
+                    stack_.Top()[-1] = instance->fields[slot];
+                    VM_BREAK;
                 }
 
-                if (!BindMethod(instance->klass, name))
+                /* kOpGetMethod is followed by the call of the method it
+                   binds, which recycles it. */
+                bool transient =
+                    (Chunk::OpCode::kOpGetMethod == instruction) ||
+                    (Chunk::OpCode::kOpGetMethodLong == instruction);
+                VM_STORE_FRAME();
+                if (!BindMethod(instance->klass, name, transient))
                     return InterpretResult::kInterpretRuntimeError;
-                break;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSetProperty: {
-                if (!obj::IsInstance(Peek(1))) {
-                    RuntimeError("Only instances have fields.");
-                    return InterpretResult::kInterpretRuntimeError;
+            VM_CASE(kOpSetPropertyLong):
+                operand = VM_READ_LONG();
+                goto set_property;
+            VM_CASE(kOpSetProperty):
+                operand = VM_READ_BYTE();
+            set_property: {
+                if (!obj::IsInstance(stack_.Peek(1))) {
+                    VM_RUNTIME_ERROR("Only instances have fields.");
                 }
 
-                std::shared_ptr<obj::ObjInstance> instance =
-                    obj::AsInstance(Peek(1));
-                instance->fields[ReadString(frame)] = Peek(0);
+                obj::ObjInstance* instance = obj::AsInstance(stack_.Peek(1));
+                LoxString name = VM_OPERAND_STRING();
+                Chunk::InlineCache& cache = caches[VM_READ_SHORT()];
+                if (cache.shape != instance->shape) {
+                    int slot = instance->shape->Lookup(name);
+                    cache.shape = instance->shape;
+                    if (slot >= 0) {
+                        cache.slot       = static_cast<uint32_t>(slot);
+                        cache.transition = nullptr;
+                    } else {
+                        cache.slot       = instance->shape->Size();
+                        cache.transition = instance->shape->Transition(name);
+                    }
+                }
 
-                val::Value value = Pop();
-                Pop();
-                Push(value);
-                break;
+                if (cache.transition) {
+                    instance->fields.push_back(stack_.Peek(0));
+                    instance->shape = cache.transition;
+                } else {
+                    instance->fields[cache.slot] = stack_.Peek(0);
+                }
+
+                val::Value value = stack_.Pop();
+                stack_.Pop();
+                stack_.Push(value);
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpInvoke: {
-                LoxString method = ReadString(frame);
-                int arg_count = ReadByte(frame);
-                if (!Invoke(method, arg_count))
+            VM_CASE(kOpInvokeLong):
+                operand = VM_READ_LONG();
+                goto invoke;
+            VM_CASE(kOpInvoke):
+                operand = VM_READ_BYTE();
+            invoke: {
+                LoxString method = VM_OPERAND_STRING();
+                int arg_count = VM_READ_BYTE();
+                Chunk::InlineCache& cache = caches[VM_READ_SHORT()];
+                VM_STORE_FRAME();
+                if (!Invoke(method, arg_count, cache))
                     return InterpretResult::kInterpretRuntimeError;
 
-                frame = &frames_[frame_count - 1];
-                break;
+                VM_LOAD_FRAME();
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpMethod:
-                DefineMethod(ReadString(frame));
-                break;
-            case Chunk::OpCode::kOpInherit: {
-                val::Value superclass = Peek(1);
+            VM_CASE(kOpMethodLong):
+                operand = VM_READ_LONG();
+                goto method;
+            VM_CASE(kOpMethod):
+                operand = VM_READ_BYTE();
+            method:
+                /* Compiled code always has a class and a closure here, an
+                   image only passes Chunk::Verify(). */
+                if (!obj::IsClass(stack_.Peek(1)) ||
+                    !obj::IsClosure(stack_.Peek(0))) {
+                    VM_RUNTIME_ERROR("Only classes have methods.");
+                }
+                DefineMethod(VM_OPERAND_STRING());
+                VM_BREAK;
+            VM_CASE(kOpInherit): {
+                val::Value superclass = stack_.Peek(1);
                 if (!obj::IsClass(superclass)) {
-                    RuntimeError("Superclass must be a class.");
-                    return InterpretResult::kInterpretRuntimeError;
+                    VM_RUNTIME_ERROR("Superclass must be a class.");
+                }
+                if (!obj::IsClass(stack_.Peek(0))) {
+                    VM_RUNTIME_ERROR("Only classes can inherit.");
                 }
 
-                std::shared_ptr<obj::ObjClass> subclass =
-                    obj::AsClass(Peek(0));
-                for (const auto& kv : obj::AsClass(superclass)->methods)
-                    subclass->methods[kv.first] = kv.second;
+                obj::ObjClass* subclass = obj::AsClass(stack_.Peek(0));
+                subclass->methods.AddAll(obj::AsClass(superclass)->methods);
 
-                Pop();
-                break;
+                stack_.Pop();
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpGetSuper: {
-                LoxString name = ReadString(frame);
-                std::shared_ptr<obj::ObjClass> superclass =
-                    obj::AsClass(Pop());
+            VM_CASE(kOpGetSuperLong):
+                operand = VM_READ_LONG();
+                goto get_super;
+            VM_CASE(kOpGetSuper):
+                operand = VM_READ_BYTE();
+            get_super: {
+                LoxString name = VM_OPERAND_STRING();
+                if (!obj::IsClass(stack_.Peek(0))) {
+                    VM_RUNTIME_ERROR("Superclass must be a class.");
+                }
+                obj::ObjClass* superclass = obj::AsClass(stack_.Pop());
 
+                VM_STORE_FRAME();
                 if (!BindMethod(superclass, name))
                     return InterpretResult::kInterpretRuntimeError;
-                break;
+                VM_BREAK;
             }
-            case Chunk::OpCode::kOpSuperInvoke: {
-                LoxString method = ReadString(frame);
-                int arg_count = ReadByte(frame);
-                std::shared_ptr<obj::ObjClass> superclass =
-                    obj::AsClass(Pop());
+            VM_CASE(kOpSuperInvokeLong):
+                operand = VM_READ_LONG();
+                goto super_invoke;
+            VM_CASE(kOpSuperInvoke):
+                operand = VM_READ_BYTE();
+            super_invoke: {
+                LoxString method = VM_OPERAND_STRING();
+                int arg_count = VM_READ_BYTE();
+                if (!obj::IsClass(stack_.Peek(0))) {
+                    VM_RUNTIME_ERROR("Superclass must be a class.");
+                }
+                obj::ObjClass* superclass = obj::AsClass(stack_.Pop());
+                VM_STORE_FRAME();
                 if (!InvokeFromClass(superclass, method, arg_count))
                     return InterpretResult::kInterpretRuntimeError;
 
-                frame = &frames_[frame_count - 1];
-                break;
+                VM_LOAD_FRAME();
+                VM_BREAK;
             }
+#ifndef COMPUTED_GOTO
         }
     }
+#endif
+
+#undef VM_LOAD_FRAME
+#undef VM_STORE_FRAME
+#undef VM_READ_BYTE
+#undef VM_READ_SHORT
+#undef VM_READ_LONG
+#undef VM_OPERAND_STRING
+#undef VM_RUNTIME_ERROR
+#undef VM_TRACE
+#undef VM_PROFILE
+#undef VM_DISPATCH
+#undef VM_CASE
+#undef VM_BREAK
 }
 
-VirtualMachine::VirtualMachine() :
-    interned_strs_(std::make_shared<LoxStringMap>()),
+void
+VirtualMachine::MarkRoots(obj::Heap& heap)
+{
+    for (val::Value* slot = stack_.Base(); slot < stack_.Top(); slot++)
+        heap.MarkValue(*slot);
+
+    for (int i = 0; i < frame_count; ++i)
+        heap.MarkObject(frames_[i].closure);
+
+    for (UpvaluePtr upvalue = open_upvalues_; upvalue;
+         upvalue = upvalue->next) {
+        heap.MarkObject(upvalue);
+    }
+
+    for (obj::ObjString* name : globals_.Names())
+        heap.MarkObject(name);
+    for (const val::Value& value : globals_.Values())
+        heap.MarkValue(value);
+    heap.MarkObject(init_string_);
+    for (obj::ObjBoundMethod* bound : spare_bound_methods_)
+        heap.MarkObject(bound);
+    if (profiler_)
+        profiler_->MarkRoots(heap);
+}
+
+VirtualMachine::VirtualMachine(
+    std::size_t gc_threshold,
+    std::size_t gc_grow_factor,
+    std::size_t max_frames) :
+    heap_(gc_threshold, gc_grow_factor),
     frame_count(0),
+    max_frames_(max_frames),
     open_upvalues_(nullptr),
-    init_string_(nullptr)
+    init_string_(nullptr),
+    optimize_(true)
 {
-    ResetStack();
-    init_string_ = obj::CopyString("init", interned_strs_);
+    heap_.PushRootMarker([this](obj::Heap& heap) { MarkRoots(heap); });
+
+    init_string_ = obj::CopyString(heap_, "init");
     DefineNative("clock", ClockNative);
 }
 
@@ -529,19 +994,70 @@ VirtualMachine::Interpret(
     const std::string& source)
 {
     lox::cl::Compiler compiler;
-    std::shared_ptr<obj::ObjFunction> function =
-        compiler.Compile(source, interned_strs_);
+    obj::ObjFunction* function =
+        compiler.Compile(source, heap_, globals_, optimize_);
+
+    if (!function)
+        return InterpretResult::kInterpretCompileError;
+
+    return Execute(function);
+}
+
+VirtualMachine::InterpretResult
+VirtualMachine::CompileImage(
+    const std::string& source,
+    const std::string& path)
+{
+    lox::cl::Compiler compiler;
+    obj::ObjFunction* function =
+        compiler.Compile(source, heap_, globals_, optimize_);
 
     if (!function)
         return InterpretResult::kInterpretCompileError;
+    if (!img::WriteImage(function, globals_, path))
+        return InterpretResult::kInterpretImageError;
+
+    return InterpretResult::kInterpretOk;
+}
+
+VirtualMachine::InterpretResult
+VirtualMachine::InterpretImage(
+    const std::string& path)
+{
+    obj::ObjFunction* function = img::LoadImage(path, heap_, globals_);
+
+    if (!function)
+        return InterpretResult::kInterpretImageError;
+
+    return Execute(function);
+}
 
-    Push(obj::ObjVal(function));
-    std::shared_ptr<obj::ObjClosure> closure = obj::NewClosure(function);
-    Pop();
-    Push(obj::ObjVal(closure));
+VirtualMachine::InterpretResult
+VirtualMachine::Execute(
+    obj::ObjFunction* function)
+{
+    EnsureStack(1);
+    stack_.Push(obj::ObjVal(function));
+    obj::ObjClosure* closure = obj::NewClosure(heap_, function);
+    stack_.Pop();
+    stack_.Push(obj::ObjVal(closure));
     Call(closure, 0);
 
-    return Run();
+    if (!profiler_)
+        return Run<false>();
+
+    InterpretResult result = Run<true>();
+    profiler_->Stop();
+    return result;
+}
+
+void
+VirtualMachine::SetProfile(bool enabled)
+{
+    if (enabled)
+        profiler_ = std::make_unique<Profiler>();
+    else
+        profiler_.reset();
 }
 } // end vm
 } // end lox
@@ -0,0 +1,34 @@
+# Run the Lox script SCRIPT with the interpreter LOX in MODE (source,
+# no_optimize or image) and compare what it prints with the file EXPECTED.
+# Image mode first compiles SCRIPT to the image file IMAGE.
+
+if(MODE STREQUAL "image")
+    execute_process(
+        COMMAND ${LOX} --compile ${SCRIPT} -o ${IMAGE}
+        RESULT_VARIABLE status
+        ERROR_VARIABLE  errors
+    )
+    if(NOT status EQUAL 0)
+        message(FATAL_ERROR "unable to compile ${SCRIPT}:\n${errors}")
+    endif()
+    set(args ${IMAGE})
+elseif(MODE STREQUAL "no_optimize")
+    set(args --no-optimize ${SCRIPT})
+else()
+    set(args ${SCRIPT})
+endif()
+
+execute_process(
+    COMMAND ${LOX} ${args}
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE  errors
+    RESULT_VARIABLE status
+)
+set(actual "${output}${errors}exit: ${status}\n")
+
+file(READ ${EXPECTED} expected)
+if(NOT actual STREQUAL expected)
+    message(FATAL_ERROR "output of ${SCRIPT} (${MODE}) differs\n"
+                        "--- expected\n${expected}"
+                        "--- actual\n${actual}")
+endif()